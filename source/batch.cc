@@ -0,0 +1,40 @@
+#include "batch.h"
+
+int main(int argc, char* argv[])
+{
+    EvoConfig config;
+    config.Read("NDim.cfg");
+    auto args = emp::cl::ArgManager(argc, argv);
+    if (args.ProcessConfigOptions(config, std::cout, "NDim.cfg", "NDim-macros.h") == false) exit(0);
+    if (args.TestUnknown() == false) exit(0);  // If there are leftover args, throw an error.
+
+    // Write to screen how the experiment is configured
+    std::cout << "==============================" << std::endl;
+    std::cout << "|    How am I configured?    |" << std::endl;
+    std::cout << "==============================" << std::endl;
+    config.Write(std::cout);
+    std::cout << "==============================\n" << std::endl;
+
+    // Number of lanes has to be known at compile time
+    switch (config.BATCH_LANES()) {
+        case 4: {
+            BatchEnsemble<4> sim(config);
+            sim.Run();
+            break;
+        }
+        case 8: {
+            BatchEnsemble<8> sim(config);
+            sim.Run();
+            break;
+        }
+        case 16: {
+            BatchEnsemble<16> sim(config);
+            sim.Run();
+            break;
+        }
+        default:
+            std::cout << "Error: BATCH_LANES must be 4, 8, or 16." << std::endl;
+            exit(1);
+    }
+
+}
@@ -0,0 +1,410 @@
+#include <cmath>
+#include <memory>
+#include <limits>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "replicate_stats.h"
+
+// Independent xorshift128 random number generators, one per lane, laid out
+// so that all W lanes can be advanced at once with vector instructions.
+// Uses AVX-512 or AVX2 when compiled for them (e.g. with -march=native),
+// and a plain loop over lanes otherwise. Draws are uniform 31-bit integers,
+// so that they can be compared with signed 32-bit vector comparisons.
+template <size_t W>
+class LaneRandom {
+    private:
+    alignas(64) uint32_t s0[W];
+    alignas(64) uint32_t s1[W];
+    alignas(64) uint32_t s2[W];
+    alignas(64) uint32_t s3[W];
+
+    public:
+    // Seed every lane differently from a single seed (splitmix64)
+    void Seed(uint64_t seed) {
+        uint64_t x = seed;
+        auto next = [&x]() {
+            uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return (uint32_t)((z ^ (z >> 31)) >> 32);
+        };
+        for (size_t l = 0; l < W; l++) {
+            s0[l] = next();
+            s1[l] = next();
+            s2[l] = next();
+            s3[l] = next();
+            // xorshift128 gets stuck if its state is all zeros
+            if ((s0[l] | s1[l] | s2[l] | s3[l]) == 0) {
+                s0[l] = 1;
+            }
+        }
+    }
+
+    // Store the next draw from every lane in out
+    void Next(int32_t * out) {
+#if defined(__AVX512F__)
+// GCC 12 warns that the AVX-512 intrinsics may use uninitialized values
+// (from inside its own headers), although every lane is loaded first
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+        if constexpr (W % 16 == 0) {
+            for (size_t c = 0; c < W; c += 16) {
+                __m512i a = _mm512_load_si512((const void *)(s0 + c));
+                __m512i b = _mm512_load_si512((const void *)(s1 + c));
+                __m512i d = _mm512_load_si512((const void *)(s2 + c));
+                __m512i e = _mm512_load_si512((const void *)(s3 + c));
+                __m512i t = _mm512_xor_si512(a, _mm512_slli_epi32(a, 11));
+                t = _mm512_xor_si512(t, _mm512_srli_epi32(t, 8));
+                __m512i n = _mm512_xor_si512(_mm512_xor_si512(e, _mm512_srli_epi32(e, 19)), t);
+                _mm512_store_si512((void *)(s0 + c), b);
+                _mm512_store_si512((void *)(s1 + c), d);
+                _mm512_store_si512((void *)(s2 + c), e);
+                _mm512_store_si512((void *)(s3 + c), n);
+                _mm512_storeu_si512((void *)(out + c), _mm512_srli_epi32(n, 1));
+            }
+            return;
+        }
+#pragma GCC diagnostic pop
+#endif
+#if defined(__AVX2__)
+        if constexpr (W % 8 == 0) {
+            for (size_t c = 0; c < W; c += 8) {
+                __m256i a = _mm256_load_si256((const __m256i *)(s0 + c));
+                __m256i b = _mm256_load_si256((const __m256i *)(s1 + c));
+                __m256i d = _mm256_load_si256((const __m256i *)(s2 + c));
+                __m256i e = _mm256_load_si256((const __m256i *)(s3 + c));
+                __m256i t = _mm256_xor_si256(a, _mm256_slli_epi32(a, 11));
+                t = _mm256_xor_si256(t, _mm256_srli_epi32(t, 8));
+                __m256i n = _mm256_xor_si256(_mm256_xor_si256(e, _mm256_srli_epi32(e, 19)), t);
+                _mm256_store_si256((__m256i *)(s0 + c), b);
+                _mm256_store_si256((__m256i *)(s1 + c), d);
+                _mm256_store_si256((__m256i *)(s2 + c), e);
+                _mm256_store_si256((__m256i *)(s3 + c), n);
+                _mm256_storeu_si256((__m256i *)(out + c), _mm256_srli_epi32(n, 1));
+            }
+            return;
+        }
+#endif
+        for (size_t l = 0; l < W; l++) {
+            uint32_t t = s0[l] ^ (s0[l] << 11);
+            s0[l] = s1[l];
+            s1[l] = s2[l];
+            s2[l] = s3[l];
+            s3[l] = s3[l] ^ (s3[l] >> 19) ^ t ^ (t >> 8);
+            out[l] = (int32_t)(s3[l] >> 1);
+        }
+    }
+};
+
+// Largest 31-bit draw that counts as an event happening, for an event
+// with probability p. Draws d are uniform on [0, 2^31), and the event
+// happens if d <= threshold, so p = 0 never happens and p = 1 always does.
+int32_t DrawThreshold(double p) {
+    if (p <= 0) return -1;
+    if (p >= 1) return std::numeric_limits<int32_t>::max();
+    return (int32_t)(std::llround(p * 2147483648.0) - 1);
+}
+
+// Advances W replicates of the NDimSim model in lockstep, one per vector
+// lane. Population sizes are stored genotype-major (pops[g * W + l] is the
+// size of genotype g in lane l), so each step over a genotype touches W
+// adjacent values. Every lane loops over max-over-lanes individuals of each
+// genotype (lanes with fewer individuals just ignore the extras), drawing
+// death, birth, and mutation numbers from its own random number stream.
+//
+// Lanes share one fitness schedule, which is evaluated once per generation
+// by an NDimSim (so every fitness change rule is supported), but each lane
+// has its own birth rates, since those depend on its population density.
+// Mutation uses the transition matrix, but is sampled differently than
+// NDimSim (no mutation is checked first, and only lanes where it happens
+// fall back to scalar code), so results differ from NDimSim for the same
+// seed, though the model is the same. PARALLEL_STEP, COMMON_RANDOM_NUMBERS,
+// and STEADY_STATE_TOLERANCE are ignored.
+template <size_t W>
+class BatchSim {
+    private:
+    std::ostream null_os;
+    NDimSim schedule_sim; // Only used to evaluate the fitness change rule
+    LaneRandom<W> rnd;
+    int curr_gen = 0;
+
+    emp::vector<int32_t> init_pops; // Per genotype
+    emp::vector<int32_t> pops; // Per genotype per lane
+    emp::vector<int32_t> new_pops; // Per genotype per lane
+    emp::vector<int32_t> birth_thresholds; // Per genotype per lane
+
+    // No-mutation threshold per genotype, and for each genotype the genotypes
+    // it can mutate to, with cumulative probabilities given that it mutates
+    emp::vector<int32_t> stay_thresholds;
+    emp::vector<emp::vector<int>> mut_targets;
+    emp::vector<emp::vector<double>> mut_cdfs;
+
+    // Localized config parameters
+    int N_GENOTYPES;
+    int GENERATIONS;
+    double K;
+    double MAX_BIRTH_RATE;
+    int32_t death_threshold;
+
+    public:
+    BatchSim(EvoConfig & config)
+        : null_os(nullptr), schedule_sim(config, null_os, null_os) {
+        N_GENOTYPES = config.N_GENOTYPES();
+        GENERATIONS = config.GENERATIONS();
+        K = config.K();
+        MAX_BIRTH_RATE = config.MAX_BIRTH_RATE();
+        death_threshold = DrawThreshold(config.DEATH_RATE());
+
+        for (long double pop : schedule_sim.GetCurrentPops()) {
+            init_pops.push_back((int32_t) std::ceil(pop));
+        }
+        pops.resize(N_GENOTYPES * W);
+        new_pops.resize(N_GENOTYPES * W);
+        birth_thresholds.resize(N_GENOTYPES * W);
+
+        emp::vector<emp::IndexMap> mut_rates = schedule_sim.GetMutRates();
+        stay_thresholds.resize(N_GENOTYPES);
+        mut_targets.resize(N_GENOTYPES);
+        mut_cdfs.resize(N_GENOTYPES);
+        for (int g = 0; g < N_GENOTYPES; g++) {
+            stay_thresholds[g] = DrawThreshold(mut_rates[g].GetWeight(g) / mut_rates[g].GetWeight());
+            double total = 0;
+            for (int j = 0; j < N_GENOTYPES; j++) {
+                if (j != g && mut_rates[g].GetWeight(j) > 0) {
+                    total += mut_rates[g].GetWeight(j);
+                    mut_targets[g].push_back(j);
+                    mut_cdfs[g].push_back(total);
+                }
+            }
+            for (double & p : mut_cdfs[g]) {
+                p /= total;
+            }
+        }
+    }
+
+    // Start over from the initial population, with a new random number stream
+    void Reset(uint64_t seed) {
+        rnd.Seed(seed);
+        curr_gen = 0;
+        for (int g = 0; g < N_GENOTYPES; g++) {
+            for (size_t l = 0; l < W; l++) {
+                pops[g * W + l] = init_pops[g];
+            }
+        }
+    }
+
+    // Which genotype an offspring of genotype g mutated to, given that the
+    // mutation draw d was above the no-mutation threshold (so d is uniform
+    // over the remaining range, and is rescaled to pick among mutations)
+    int MutantGenotype(int g, int32_t d) {
+        double range = 2147483648.0 - ((double)stay_thresholds[g] + 1);
+        double u = ((double)d - stay_thresholds[g] - .5) / range;
+        const emp::vector<double> & cdf = mut_cdfs[g];
+        for (size_t j = 0; j < cdf.size(); j++) {
+            if (u < cdf[j]) {
+                return mut_targets[g][j];
+            }
+        }
+        return mut_targets[g].back();
+    }
+
+    void RunStep() {
+        // Fitnesses are the same for every lane
+        schedule_sim.SetGeneration(curr_gen);
+        schedule_sim.UpdateSs();
+        const emp::vector<long double> & rel_fitnesses = schedule_sim.GetRelFitnesses();
+
+        // Birth rates depend on each lane's total population size
+        alignas(64) double totals[W] = {};
+        for (int g = 0; g < N_GENOTYPES; g++) {
+            for (size_t l = 0; l < W; l++) {
+                totals[l] += pops[g * W + l];
+            }
+        }
+        for (int g = 0; g < N_GENOTYPES; g++) {
+            for (size_t l = 0; l < W; l++) {
+                double T = totals[l]/K;
+                double birth = T > 1 ? 0 : MAX_BIRTH_RATE*(1-T);
+                birth_thresholds[g * W + l] = DrawThreshold(birth/(1 + (double)rel_fitnesses[g]));
+            }
+        }
+
+        std::fill(new_pops.begin(), new_pops.end(), 0);
+
+        alignas(64) int32_t death_draws[W];
+        alignas(64) int32_t birth_draws[W];
+        alignas(64) int32_t mut_draws[W];
+        alignas(64) int32_t mutants[W];
+
+        for (int g = 0; g < N_GENOTYPES; g++) {
+            const int32_t * n = &pops[g * W];
+            const int32_t * birth_thr = &birth_thresholds[g * W];
+            const int32_t stay_thr = stay_thresholds[g];
+            const int32_t death_thr = death_threshold;
+            alignas(64) int32_t kept[W] = {}; // Survivors plus unmutated offspring
+
+            int32_t max_n = 0;
+            for (size_t l = 0; l < W; l++) {
+                max_n = std::max(max_n, n[l]);
+            }
+
+            for (int32_t i = 0; i < max_n; i++) {
+                rnd.Next(death_draws);
+                rnd.Next(birth_draws);
+                rnd.Next(mut_draws);
+
+                // Branch-free so that the compiler can vectorize it
+                int32_t any_mutants = 0;
+                for (size_t l = 0; l < W; l++) {
+                    int32_t alive = (i < n[l]) & (death_draws[l] > death_thr);
+                    int32_t born = alive & (birth_draws[l] <= birth_thr[l]);
+                    int32_t stay = born & (mut_draws[l] <= stay_thr);
+                    kept[l] += alive + stay;
+                    mutants[l] = born - stay;
+                    any_mutants |= mutants[l];
+                }
+
+                // Mutations are rare, so handle them one lane at a time
+                if (any_mutants) {
+                    for (size_t l = 0; l < W; l++) {
+                        if (mutants[l]) {
+                            new_pops[MutantGenotype(g, mut_draws[l]) * W + l]++;
+                        }
+                    }
+                }
+            }
+
+            for (size_t l = 0; l < W; l++) {
+                new_pops[g * W + l] += kept[l];
+            }
+        }
+
+        std::swap(pops, new_pops);
+    }
+
+    // Run for the configured number of generations, calling record(gen)
+    // with the state at the start of each generation
+    template <typename RECORD_FUN>
+    void Run(RECORD_FUN record) {
+        for (int gen = 0; gen <= GENERATIONS; gen++) {
+            curr_gen = gen;
+            record(gen);
+            RunStep();
+        }
+    }
+
+    int32_t GetPop(int genotype, size_t lane) const {return pops[genotype * W + lane];}
+};
+
+// Runs BATCH_REPLICATES replicates (rounded up to a multiple of W) as
+// batches of W lanes, with ENSEMBLE_THREADS batches running at a time.
+// Per-generation means and variances of each genotype's proportion are
+// calculated within each batch, then combined across batches in batch
+// order, so results for a given RANDOM_SEED don't depend on the number
+// of threads.
+template <size_t W>
+class BatchEnsemble {
+    private:
+    emp::vector<std::unique_ptr<BatchSim<W>>> sims; // One per thread
+    emp::Random rnd; // For seeding batches
+
+    // Each genotype's proportion at each generation (generation-major),
+    // overall and for each running batch
+    ReplicateStats stats;
+    emp::vector<ReplicateStats> batch_stats;
+
+    // Localized config parameters
+    int N_GENOTYPES;
+    int GENERATIONS;
+    int BATCH_REPLICATES;
+    int ENSEMBLE_THREADS;
+
+    public:
+    BatchEnsemble(EvoConfig & config) : rnd(config.RANDOM_SEED()) {
+        N_GENOTYPES = config.N_GENOTYPES();
+        GENERATIONS = config.GENERATIONS();
+        BATCH_REPLICATES = config.BATCH_REPLICATES();
+        ENSEMBLE_THREADS = EnsembleThreads(config);
+
+        int n_batches = (BATCH_REPLICATES + W - 1) / W;
+        ENSEMBLE_THREADS = std::max(1, std::min(ENSEMBLE_THREADS, n_batches));
+
+        // Batches already run in parallel, so the NDimSim each one uses for
+        // its fitness schedule shouldn't start step threads of its own
+        config.STEP_THREADS(1);
+
+        size_t n_values = (GENERATIONS + 1) * N_GENOTYPES;
+        stats.Resize(n_values);
+        batch_stats.resize(ENSEMBLE_THREADS);
+        for (int t = 0; t < ENSEMBLE_THREADS; t++) {
+            sims.emplace_back(new BatchSim<W>(config));
+            batch_stats[t].Resize(n_values);
+        }
+    }
+
+    // Run one batch, storing per-generation statistics across its lanes
+    void RunBatch(int t, uint64_t seed) {
+        BatchSim<W> & sim = *sims[t];
+        ReplicateStats & b_stats = batch_stats[t];
+
+        sim.Reset(seed);
+        b_stats.count = W;
+        sim.Run([&](int gen){
+            double totals[W] = {};
+            for (int i = 0; i < N_GENOTYPES; i++) {
+                for (size_t l = 0; l < W; l++) {
+                    totals[l] += sim.GetPop(i, l);
+                }
+            }
+            for (int i = 0; i < N_GENOTYPES; i++) {
+                double props[W];
+                double mean = 0;
+                for (size_t l = 0; l < W; l++) {
+                    props[l] = totals[l] > 0 ? sim.GetPop(i, l) / totals[l] : 0;
+                    mean += props[l];
+                }
+                mean /= W;
+                double sq = 0;
+                for (size_t l = 0; l < W; l++) {
+                    sq += (props[l] - mean) * (props[l] - mean);
+                }
+                b_stats.means[gen * N_GENOTYPES + i] = mean;
+                b_stats.sq_devs[gen * N_GENOTYPES + i] = sq;
+            }
+        });
+    }
+
+    void Run() {
+        while (stats.count < BATCH_REPLICATES) {
+            int remaining = (BATCH_REPLICATES - stats.count + W - 1) / W;
+            int wave = std::min(ENSEMBLE_THREADS, remaining);
+
+            // Seeds are drawn in batch order, before threads start
+            emp::vector<uint64_t> seeds(wave);
+            for (int t = 0; t < wave; t++) {
+                seeds[t] = ((uint64_t)rnd.GetUInt() << 32) | rnd.GetUInt();
+            }
+
+            emp::vector<std::thread> threads;
+            for (int t = 0; t < wave; t++) {
+                threads.emplace_back([this, t, &seeds](){RunBatch(t, seeds[t]);});
+            }
+            for (std::thread & thread : threads) {
+                thread.join();
+            }
+
+            // Combine batches in batch order
+            for (int t = 0; t < wave; t++) {
+                stats.Merge(batch_stats[t]);
+            }
+            std::cout << stats.count << " replicates done" << std::endl;
+        }
+
+        // Same format as ensemble_props.csv
+        PrintProportions(stats, "batch_props.csv", N_GENOTYPES, GENERATIONS);
+    }
+
+};
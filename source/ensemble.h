@@ -0,0 +1,120 @@
+#include <memory>
+
+#include "replicate_stats.h"
+
+// Runs replicates of NDimSim until the mean proportion of each genotype
+// at each generation is known to within CI_TARGET (95% confidence
+// interval half-width), or until MAX_REPLICATES have been run.
+//
+// Replicates are run in batches of ENSEMBLE_THREADS at a time, each on
+// its own thread. Per-generation means and variances are accumulated
+// with Welford's algorithm, in replicate order, and confidence intervals
+// are checked after every replicate, so results for a given RANDOM_SEED
+// don't depend on the number of threads.
+class EnsembleSim {
+    private:
+    // One simulation per thread, reused for every replicate that thread runs
+    emp::vector<std::unique_ptr<std::ostream>> null_streams;
+    emp::vector<std::unique_ptr<NDimSim>> sims;
+    NDimSim::SimState initial;
+
+    emp::Random rnd; // For seeding replicates
+
+    // Each genotype's proportion at each generation (generation-major)
+    ReplicateStats stats;
+    int early_stops = 0; // Replicates in stats that stopped early
+
+    // Localized config parameters
+    int N_GENOTYPES;
+    int GENERATIONS;
+    int MIN_REPLICATES;
+    int MAX_REPLICATES;
+    double CI_TARGET;
+    int ENSEMBLE_THREADS;
+
+    public:
+    EnsembleSim(EvoConfig & config) : rnd(config.RANDOM_SEED()) {
+        N_GENOTYPES = config.N_GENOTYPES();
+        GENERATIONS = config.GENERATIONS();
+        MIN_REPLICATES = config.MIN_REPLICATES();
+        MAX_REPLICATES = config.MAX_REPLICATES();
+        CI_TARGET = config.CI_TARGET();
+        ENSEMBLE_THREADS = EnsembleThreads(config);
+
+        if (MIN_REPLICATES < 2 || MAX_REPLICATES < MIN_REPLICATES) {
+            std::cout << "Error: Need 2 <= MIN_REPLICATES <= MAX_REPLICATES." << std::endl;
+            exit(1);
+        }
+
+        // Replicates already run in parallel, and results don't depend on
+        // STEP_THREADS, so don't split individual steps across threads too
+        config.STEP_THREADS(1);
+
+        // Set up simulations up front (and one at a time), since reading
+        // the configuration prints to the screen
+        for (int i = 0; i < ENSEMBLE_THREADS; i++) {
+            null_streams.emplace_back(new std::ostream(nullptr));
+            sims.emplace_back(new NDimSim(config, *null_streams.back(), *null_streams.back()));
+            sims.back()->SetRecordTrajectory(true);
+        }
+        initial = sims[0]->GetState();
+
+        stats.Resize((GENERATIONS + 1) * N_GENOTYPES);
+    }
+
+    void Run() {
+        double width = INFINITY;
+
+        while (stats.count < MAX_REPLICATES) {
+            int batch = std::min(ENSEMBLE_THREADS, MAX_REPLICATES - stats.count);
+
+            // Seeds are drawn in replicate order, before threads start
+            emp::vector<int> seeds(batch);
+            for (int i = 0; i < batch; i++) {
+                seeds[i] = ReplicateSeed(rnd);
+            }
+
+            emp::vector<std::thread> threads;
+            for (int i = 0; i < batch; i++) {
+                threads.emplace_back([this, i, &seeds](){
+                    sims[i]->SetState(initial);
+                    sims[i]->Reseed(seeds[i]);
+                    sims[i]->Run();
+                });
+            }
+            for (std::thread & t : threads) {
+                t.join();
+            }
+
+            // Add replicates in order, checking after each one, so that the
+            // stopping point doesn't depend on how many ran at once. Any
+            // replicates in the batch after that point are dropped.
+            for (int i = 0; i < batch && width > CI_TARGET; i++) {
+                stats.Add(TrajectoryProportions(sims[i]->GetTrajectory(), N_GENOTYPES));
+                if (sims[i]->GetStopGeneration() >= 0) {
+                    early_stops++;
+                }
+                if (stats.count >= MIN_REPLICATES) {
+                    width = stats.MaxCIHalfWidth();
+                }
+            }
+            if (stats.count >= MIN_REPLICATES) {
+                std::cout << stats.count << " replicates, widest 95% CI half-width: " << width << std::endl;
+            }
+            if (width <= CI_TARGET) {
+                break;
+            }
+        }
+
+        if (early_stops > 0) {
+            std::cout << early_stops << " of " << stats.count << " replicates stopped early" << std::endl;
+        }
+        if (width > CI_TARGET) {
+            std::cout << "Warning: reached MAX_REPLICATES before confidence intervals reached CI_TARGET." << std::endl;
+        }
+        // Mean proportion of each genotype at each generation and its 95%
+        // confidence interval half-width
+        PrintProportions(stats, "ensemble_props.csv", N_GENOTYPES, GENERATIONS);
+    }
+
+};
@@ -17,6 +17,9 @@ int main(int argc, char* argv[])
 
     NDimSim sim(config);
     sim.Run();
+    if (sim.GetStopGeneration() >= 0) {
+        std::cout << "Stopped early at generation " << sim.GetStopGeneration() << std::endl;
+    }
 
 }
  
\ No newline at end of file
@@ -1,3 +1,10 @@
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <cstdint>
+
 #include "base/vector.h"
 #include "config/command_line.h"
 #include "config/ArgManager.h"
@@ -17,12 +24,47 @@ EMP_BUILD_CONFIG( EvoConfig,
     VALUE(MAX_BIRTH_RATE, double, 2, "Maximum birth rate (b0)"),
 
     GROUP(FITNESS_CHANGE_PARAMETERS, "Parameters associated with various fitness change rules"),
-    VALUE(FITNESS_CHANGE_RULE, int, 0, "Rule governing how fitnesses should change. 0 = NONE, 1 = VAR, 2 = VARCD, 3 = Drug with increasing dose, 4 = Drug with fixed dose, 5 = CD Driving prescription specified in file."),
+    VALUE(FITNESS_CHANGE_RULE, int, 0, "Rule governing how fitnesses should change. 0 = NONE, 1 = VAR, 2 = VARCD, 3 = Drug with increasing dose, 4 = Drug with fixed dose, 5 = CD Driving prescription specified in file, 6 = Switch between ENVIRONMENTS according to ENVIRONMENT_SCHEDULE."),
     VALUE(GENOTYPE_TO_DRIVE, int, 0, "For fitness change rules that only apply to one genotype (VAR and VARCD), which genotype should be changed?"),    
     VALUE(TIME_STEPS_BEFORE_RAMP_UP, int, 0, "For fitness change rule 3, how long to wait before we start increasing concentration"),
     VALUE(DRUG_DOSE, double, .00015, "For fitness change rules 3 and 4"),
     VALUE(CD_DRIVING_PRESCRIPTION, std::string, "driving.csv", "File containing driving prescription for use with fitness change rule 5"),
 
+    GROUP(ENVIRONMENT_PARAMETERS, "Parameters for switching between environments (fitness change rule 6)"),
+    VALUE(ENVIRONMENTS, std::string, "1,1", "Semicolon-separated list of environments. Each is either a sum of fitness landscapes (files or lists of growth rates, optionally weighted, e.g. .5*amc_fitnesses.dat+.5*cpd_fitnesses.dat), or a combination of drugs at fixed doses (IC50 file or list @ dose, e.g. pyrimethamine_log_IC50s.dat@.0001+cycloguanil_log_IC50s.dat@.001), which act independently on G_DRUGLESSES using CS."),
+    VALUE(ENVIRONMENT_SCHEDULE, std::string, "0:1", "Comma-separated environment:duration pairs giving the order in which to apply ENVIRONMENTS (indexed from 0) and how many generations to spend in each"),
+    VALUE(ENVIRONMENT_CYCLE, bool, true, "Repeat ENVIRONMENT_SCHEDULE until the end of the run (otherwise stay in the last environment once it is over)"),
+
+    GROUP(PARALLEL_PARAMETERS, "Parameters for running a single replicate across multiple threads"),
+    VALUE(PARALLEL_STEP, bool, false, "Split each generation into blocks of individuals that are processed in parallel, each with its own random number stream. Results depend only on RANDOM_SEED and STEP_BLOCK_SIZE, not on STEP_THREADS (but differ from serial runs with the same seed)."),
+    VALUE(STEP_THREADS, int, 0, "Number of threads to use if PARALLEL_STEP is set (0 = number of available cores)"),
+    VALUE(STEP_BLOCK_SIZE, int, 262144, "Maximum number of individuals in each block if PARALLEL_STEP is set"),
+    VALUE(COMMON_RANDOM_NUMBERS, bool, false, "Use the block-based step from PARALLEL_STEP, with separate random number streams for death, birth, and mutation that every individual draws from exactly once. Runs with the same RANDOM_SEED then share random numbers individual-by-individual, even under different fitness change rules."),
+
+    GROUP(ENSEMBLE_PARAMETERS, "Parameters for stopping runs early and for adaptively sized ensembles (ensemble executable)"),
+    VALUE(STEADY_STATE_TOLERANCE, double, 0, "Stop a run once no genotype's proportion of the population has changed by more than this over STEADY_STATE_WINDOW generations, and fill in the remaining generations with the final state (0 = never stop early). Only used with fitness change rules 0 and 4, where fitnesses are constant."),
+    VALUE(STEADY_STATE_WINDOW, int, 1000, "Number of generations over which to check for steady state"),
+    VALUE(MIN_REPLICATES, int, 100, "Minimum number of replicates in an ensemble"),
+    VALUE(MAX_REPLICATES, int, 1000, "Maximum number of replicates in an ensemble"),
+    VALUE(CI_TARGET, double, .005, "Keep adding replicates to the ensemble until the 95% confidence interval half-width of every genotype's mean proportion, at every generation, is at most this"),
+    VALUE(ENSEMBLE_THREADS, int, 0, "Number of replicates to run at once (0 = number of available cores)"),
+
+    GROUP(BATCH_PARAMETERS, "Parameters for running replicates in lockstep in vector lanes (batch executable)"),
+    VALUE(BATCH_LANES, int, 8, "Number of replicates to advance together on each thread (4, 8, or 16). Use 8 for AVX2 and 16 for AVX-512."),
+    VALUE(BATCH_REPLICATES, int, 1000, "Number of replicates to run (rounded up to a multiple of BATCH_LANES)"),
+
+    GROUP(PAIRED_PARAMETERS, "Parameters for comparing protocols on common random numbers (paired executable)"),
+    VALUE(PAIRED_ARMS, std::string, "3,5", "Comma-separated protocols to compare. Each is a fitness change rule, optionally followed by a colon and a CD driving prescription file (e.g. 3,5:scdr_001_maxc01.csv). Differences are relative to the first."),
+    VALUE(PAIRED_REPLICATES, int, 100, "Number of paired replicates to run"),
+
+    GROUP(RARE_EVENT_PARAMETERS, "Parameters for estimating first-passage times with weighted ensemble splitting (rare_event executable)"),
+    VALUE(TARGET_GENOTYPE, int, 1, "Genotype whose proportion of the population is tracked (e.g. 14 = 1110 in the malaria landscape)"),
+    VALUE(TARGET_THRESHOLD, double, .5, "Proportion of the population the target genotype has to reach"),
+    VALUE(SPLITTING_LEVELS, std::string, ".001,.01,.05,.1,.2,.3,.4", "Comma-separated, increasing proportions of target genotype that divide replicates into bins. Replicates are split and merged so that each occupied bin has WALKERS_PER_BIN of them."),
+    VALUE(WALKERS_PER_BIN, int, 10, "Number of weighted replicates to maintain in each occupied bin"),
+    VALUE(RESAMPLE_INTERVAL, int, 10, "Number of generations between splitting/merging replicates"),
+    VALUE(SPLITTING_REPEATS, int, 10, "Number of independent weighted ensembles to run (used for confidence intervals)"),
+
     GROUP(PER_GENOTYPE_VALUES, "Per-genotype values"),
     VALUE(FITNESSES, std::string, "0,1", "Either a list of relative fitnesses, separated by commas, or a file containing them. These are the starting ftnesses."),
     VALUE(IC50S, std::string, "-6.0,-5.0", "For environments simulating the application of a drug, what are the IC50 values for each genotype? Specify as list of values or name of file containing them."),
@@ -33,7 +75,133 @@ EMP_BUILD_CONFIG( EvoConfig,
         "Either a matrix of transition probabilities or a file containing one. Rows are original genotype, columns are new one. Use commas to separate values within rows. In files, use newlines between rows. On command-line, use colons.")
 )
 
-enum class FITNESS_CHANGE_RULES { NONE=0, VAR=1, VARCD=2, INCREASING_DRUG=3, CONSTANT_DRUG=4, CD_PRESCRIPTION=5};
+enum class FITNESS_CHANGE_RULES { NONE=0, VAR=1, VARCD=2, INCREASING_DRUG=3, CONSTANT_DRUG=4, CD_PRESCRIPTION=5, ENVIRONMENT_SCHEDULE=6};
+
+// Hashes seed material into a seed for the random number generator
+// used by a single block of individuals in a parallel step.
+// Uses the splitmix64 finalizer, so nearby inputs give unrelated seeds.
+uint64_t BlockSeed(uint64_t base_seed, uint64_t gen, uint64_t genotype, uint64_t block) {
+    uint64_t x = base_seed;
+    for (uint64_t v : {gen, genotype, block}) {
+        x += 0x9e3779b97f4a7c15ULL + v;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        x = x ^ (x >> 31);
+    }
+    return x;
+}
+
+// Random number generator (xoshiro256**) for a single block of individuals
+// in a parallel step. emp::Random only takes 31-bit seeds, which would give
+// many pairs of identical streams across the millions of blocks in a long
+// run at large K. This takes the full 64-bit BlockSeed, and expands it into
+// 256 bits of state with splitmix64.
+class BlockRandom {
+    private:
+    uint64_t s[4];
+
+    static uint64_t Rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    public:
+    BlockRandom(uint64_t seed) {
+        for (uint64_t & word : s) {
+            uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t GetUInt64() {
+        uint64_t result = Rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = Rotl(s[3], 45);
+        return result;
+    }
+
+    // Uniform on [0, max), with 53 random bits (as for emp::Random)
+    double GetDouble(double max) {
+        return (GetUInt64() >> 11) * 0x1.0p-53 * max;
+    }
+};
+
+// Threads that stay alive between generations to share the work of
+// parallel steps, rather than being created and joined every generation.
+// The thread that calls Run() works as thread 0, so a pool for n threads
+// only starts n - 1 of its own.
+class StepPool {
+    private:
+    emp::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    std::function<void(size_t)> task;
+    uint64_t round = 0; // Incremented every time there is a new task
+    size_t n_busy = 0; // Pool threads still working on the current task
+    bool stopping = false;
+
+    void Work(size_t thread_id) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start_cv.wait(lock, [&](){return stopping || round != seen;});
+                if (stopping) {
+                    return;
+                }
+                seen = round;
+            }
+            task(thread_id);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                n_busy--;
+            }
+            done_cv.notify_one();
+        }
+    }
+
+    public:
+    StepPool(size_t n_threads) {
+        for (size_t t = 1; t < n_threads; t++) {
+            threads.emplace_back(&StepPool::Work, this, t);
+        }
+    }
+
+    ~StepPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start_cv.notify_all();
+        for (std::thread & t : threads) {
+            t.join();
+        }
+    }
+
+    size_t GetNumThreads() const {return threads.size() + 1;}
+
+    // Call fn(thread_id) on every thread in the pool (including this one),
+    // and wait for all of them to finish
+    void Run(std::function<void(size_t)> fn) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = fn;
+            n_busy = threads.size();
+            round++;
+        }
+        start_cv.notify_all();
+        fn(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [this](){return n_busy == 0;});
+    }
+};
 
 // Functions for extracting parameter lists from files
 
@@ -90,6 +258,20 @@ class NDimSim {
     // CD driving prescription (if necessary)
     emp::vector<emp::vector<long double>> cd_prescription_data;
 
+    // Relative fitnesses in each environment, precomputed so that switching
+    // environments (fitness change rule 6) doesn't require recalculating them
+    emp::vector<emp::vector<long double>> env_fitnesses;
+    emp::vector<int> env_schedule; // Index of environment at each generation
+    int current_env = -1; // Environment rel_fitnesses currently holds
+
+    // Base seed for the per-block random number streams used by
+    // RunStepParallel (drawn from rnd, so it's determined by RANDOM_SEED)
+    uint64_t step_seed = 0;
+
+    // Threads that RunStepParallel shares work with (null until the first
+    // parallel step, and always null if STEP_THREADS is 1)
+    std::unique_ptr<StepPool> step_pool;
+
     // Localized config parameters
     int N_GENOTYPES;
     int GENERATIONS;
@@ -107,33 +289,71 @@ class NDimSim {
     std::string CS;
     std::string G_DRUGLESSES;
     std::string CD_DRIVING_PRESCRIPTION;
+    std::string ENVIRONMENTS;
+    std::string ENVIRONMENT_SCHEDULE;
+    bool ENVIRONMENT_CYCLE;
+    bool PARALLEL_STEP;
+    bool COMMON_RANDOM_NUMBERS;
+    int STEP_THREADS;
+    int STEP_BLOCK_SIZE;
+    double STEADY_STATE_TOLERANCE;
+    int STEADY_STATE_WINDOW;
+
+    // Population sizes recorded at every generation since the last Reset()
+    // (or of Run(), if it was called without one), stored generation-major (GENERATIONS + 1 rows of N_GENOTYPES values)
+    // so that it can be handed out as a 2D array without copying
+    bool record_trajectory = false;
+    emp::vector<long double> trajectory;
+
+    // Run() stops early (and fills in the remaining generations with the
+    // current state) if this returns true
+    std::function<bool(const NDimSim &)> stop_condition;
+    int stop_gen = -1; // Generation the last Run() stopped at (-1 if it didn't stop early)
+
+    // Genotype proportions at the start of the current steady-state window
+    emp::vector<long double> window_props;
 
     public:
+    // Everything that changes over the course of a run, so that a run
+    // can be saved, copied, and resumed (e.g. for splitting replicates)
+    struct SimState {
+        int curr_gen;
+        emp::vector<long double> current_pops;
+        emp::vector<long double> rel_fitnesses;
+        emp::Random rnd;
+        uint64_t step_seed;
+    };
+
+    // Per-genotype values supplied directly (e.g. from Python) instead
+    // of being parsed out of config strings. ic50s, g_druglesses, and cs
+    // are only needed for the drug fitness change rules (3 and 4).
+    struct GenotypeValues {
+        emp::vector<long double> fitnesses;
+        emp::vector<long double> init_pops;
+        emp::vector<long double> ic50s;
+        emp::vector<long double> g_druglesses;
+        emp::vector<long double> cs;
+        emp::vector<emp::vector<double>> transition_probs;
+    };
+
     NDimSim(EvoConfig & config) : pop_sizes("pop_sizes.csv"), pop_props("pop_props.csv") {
         Setup(config);
     }
 
-    void Setup(EvoConfig & config) {
-        rnd = emp::Random(config.RANDOM_SEED());
+    // Write pop sizes and proportions to the supplied streams instead
+    // of pop_sizes.csv and pop_props.csv
+    NDimSim(EvoConfig & config, std::ostream & sizes_os, std::ostream & props_os) 
+        : pop_sizes(sizes_os), pop_props(props_os) {
+        Setup(config);
+    }
 
-        // Localize config parameters
-        // (we do this for efficiency)
-        N_GENOTYPES = config.N_GENOTYPES();
-        GENERATIONS = config.GENERATIONS();
-        K = config.K();
-        DEATH_RATE = config.DEATH_RATE();
-        MAX_BIRTH_RATE = config.MAX_BIRTH_RATE();
-        FITNESSES = config.FITNESSES();
-        FITNESS_CHANGE_RULE = config.FITNESS_CHANGE_RULE();
-        DRUG_DOSE = config.DRUG_DOSE();
-        GENOTYPE_TO_DRIVE = config.GENOTYPE_TO_DRIVE();
-        INIT_POPS = config.INIT_POPS();
-        TRANSITION_PROBS = config.TRANSITION_PROBS();
-        IC50S = config.IC50S();
-        CS = config.CS();        
-        G_DRUGLESSES = config.G_DRUGLESSES();        
-        TIME_STEPS_BEFORE_RAMP_UP = config.TIME_STEPS_BEFORE_RAMP_UP();        
-        CD_DRIVING_PRESCRIPTION = config.CD_DRIVING_PRESCRIPTION();        
+    NDimSim(EvoConfig & config, const GenotypeValues & values, std::ostream & sizes_os, std::ostream & props_os) 
+        : pop_sizes(sizes_os), pop_props(props_os) {
+        Setup(config, values);
+    }
+
+    void Setup(EvoConfig & config) {
+        LocalizeConfig(config);
 
         // Set-up per-genotype values
 
@@ -153,19 +373,98 @@ class NDimSim {
         // Initialize c values for each genotype
         InitializeCs();
 
-        if (FITNESS_CHANGE_RULE == (int)FITNESS_CHANGE_RULES::CONSTANT_DRUG) {
-            sDrugConcentration(DRUG_DOSE);
-        } else if (FITNESS_CHANGE_RULE == (int)FITNESS_CHANGE_RULES::CD_PRESCRIPTION) { 
+        if (FITNESS_CHANGE_RULE == (int)FITNESS_CHANGE_RULES::CD_PRESCRIPTION) { 
             cd_prescription_data = emp::File(CD_DRIVING_PRESCRIPTION).ToData<long double>();
+        } else if (FITNESS_CHANGE_RULE == (int)FITNESS_CHANGE_RULES::ENVIRONMENT_SCHEDULE) {
+            InitializeEnvironments();
         }
 
-        // Current population sizes of each genotype
-        current_pops = init_pops;
+        SetupMutRates();
+        InitializeTransitionProbs();
 
-        // Holder for population sizes currently being calculated
-        // Gets zeroed out in RunStep();
-        new_pops.resize(N_GENOTYPES);
+        FinishSetup();
+    }
+
+    void Setup(EvoConfig & config, const GenotypeValues & values) {
+        LocalizeConfig(config);
+
+        rel_fitnesses = values.fitnesses;
+        init_pops = values.init_pops;
+        IC50s = values.ic50s;
+        drugless_fitnesses = values.g_druglesses;
+        cs = values.cs;
+        if (drugless_fitnesses.size()) {
+            max_fit = emp::FindMax(drugless_fitnesses);
+        }
+
+        SetupMutRates();
+        for (int i = 0; i < N_GENOTYPES; i++) {
+            for (int j = 0; j < N_GENOTYPES; j++) {
+                mut_rates[i][j] = values.transition_probs[i][j];
+            }
+        }
+
+        FinishSetup();
+    }
+
+    // Localize config parameters
+    // (we do this for efficiency)
+    void LocalizeConfig(EvoConfig & config) {
+        rnd = emp::Random(config.RANDOM_SEED());
+
+        N_GENOTYPES = config.N_GENOTYPES();
+        GENERATIONS = config.GENERATIONS();
+        K = config.K();
+        DEATH_RATE = config.DEATH_RATE();
+        MAX_BIRTH_RATE = config.MAX_BIRTH_RATE();
+        FITNESSES = config.FITNESSES();
+        FITNESS_CHANGE_RULE = config.FITNESS_CHANGE_RULE();
+        DRUG_DOSE = config.DRUG_DOSE();
+        GENOTYPE_TO_DRIVE = config.GENOTYPE_TO_DRIVE();
+        INIT_POPS = config.INIT_POPS();
+        TRANSITION_PROBS = config.TRANSITION_PROBS();
+        IC50S = config.IC50S();
+        CS = config.CS();        
+        G_DRUGLESSES = config.G_DRUGLESSES();        
+        TIME_STEPS_BEFORE_RAMP_UP = config.TIME_STEPS_BEFORE_RAMP_UP();        
+        CD_DRIVING_PRESCRIPTION = config.CD_DRIVING_PRESCRIPTION();        
+        ENVIRONMENTS = config.ENVIRONMENTS();
+        ENVIRONMENT_SCHEDULE = config.ENVIRONMENT_SCHEDULE();
+        ENVIRONMENT_CYCLE = config.ENVIRONMENT_CYCLE();
+        PARALLEL_STEP = config.PARALLEL_STEP();
+        COMMON_RANDOM_NUMBERS = config.COMMON_RANDOM_NUMBERS();
+        STEP_THREADS = config.STEP_THREADS();
+        STEP_BLOCK_SIZE = config.STEP_BLOCK_SIZE();
+        STEADY_STATE_TOLERANCE = config.STEADY_STATE_TOLERANCE();
+        STEADY_STATE_WINDOW = config.STEADY_STATE_WINDOW();
+
+        if (STEP_THREADS <= 0) {
+            STEP_THREADS = std::max(1u, std::thread::hardware_concurrency());
+        }
+        if (STEP_BLOCK_SIZE <= 0) {
+            std::cout << "Error: STEP_BLOCK_SIZE must be positive." << std::endl;
+            exit(1);
+        }
+
+        // Steady state only means the run is done if the fitnesses won't change
+        if (STEADY_STATE_TOLERANCE > 0 && !ConstantFitnesses()) {
+            std::cout << "Warning: STEADY_STATE_TOLERANCE is only used with fitness change "
+                      << "rules 0 and 4. Runs will not stop early." << std::endl;
+            STEADY_STATE_TOLERANCE = 0;
+        }
+        if (STEADY_STATE_WINDOW <= 0) {
+            std::cout << "Error: STEADY_STATE_WINDOW must be positive." << std::endl;
+            exit(1);
+        }
 
+        // Only draw from rnd if we need to, so that serial runs stay
+        // identical to runs from before parallel steps existed
+        if (BlockStep()) {
+            step_seed = ((uint64_t)rnd.GetUInt() << 32) | rnd.GetUInt();
+        }
+    }
+
+    void SetupMutRates() {
         // Outer vector is starting genotype, inner index map is to
         // e.g. the bin size of mut_rates[3][4] represents the probability of mutating
         // from genotype 3 to genotype 4.
@@ -178,15 +477,29 @@ class NDimSim {
         for (emp::IndexMap & vec : mut_rates) {
             vec.Resize(N_GENOTYPES);
         }
-        InitializeTransitionProbs();
+    }
+
+    // Set-up that is shared regardless of where per-genotype values came from
+    void FinishSetup() {
+        if (FITNESS_CHANGE_RULE == (int)FITNESS_CHANGE_RULES::CONSTANT_DRUG) {
+            sDrugConcentration(DRUG_DOSE);
+        }
+
+        // Current population sizes of each genotype
+        current_pops = init_pops;
+
+        // Holder for population sizes currently being calculated
+        // Gets zeroed out in RunStep();
+        new_pops.resize(N_GENOTYPES);
 
         // Set up data tracking
         pop_sizes.AddVar(curr_gen,"generation");
         pop_props.AddVar(curr_gen,"generation");
         for (int i = 0; i < N_GENOTYPES; i++) {
-            // Using a reference to vector contents is safe here
-            // because vector size will never change
-            pop_sizes.AddVar(current_pops[i],"pop" + emp::to_string(i));
+            // Look pop sizes up through current_pops each time rather than
+            // holding a reference to its contents, since RunStep swaps
+            // current_pops' storage with new_pops every generation
+            pop_sizes.AddFun((std::function<long double()>)[i, this](){return current_pops[i];},"pop" + emp::to_string(i));
             pop_props.AddFun((std::function<double()>)[i, this](){return current_pops[i]/emp::Sum(current_pops);},"prop" + emp::to_string(i));
         }
         pop_sizes.PrintHeaderKeys();
@@ -245,15 +558,34 @@ class NDimSim {
             case (int)FITNESS_CHANGE_RULES::CD_PRESCRIPTION:
                 rel_fitnesses = cd_prescription_data[curr_gen];
                 break;
+            case (int)FITNESS_CHANGE_RULES::ENVIRONMENT_SCHEDULE:
+                sEnvironment(curr_gen);
+                break;
             default:
                 std::cout << "Invalid fitness change rule. Defaulting to none." << std::endl;
                 break;
         }
     }
 
+    // Whether the fitness change rule keeps fitnesses the same every generation
+    bool ConstantFitnesses() const {
+        return FITNESS_CHANGE_RULE == (int)FITNESS_CHANGE_RULES::NONE
+            || FITNESS_CHANGE_RULE == (int)FITNESS_CHANGE_RULES::CONSTANT_DRUG;
+    }
+
+    // Whether RunStep should use per-block random number streams
+    bool BlockStep() const {
+        return PARALLEL_STEP || COMMON_RANDOM_NUMBERS;
+    }
+
     void RunStep() {
         UpdateSs(); // Update fitnesses as appropriate
 
+        if (BlockStep()) {
+            RunStepParallel();
+            return;
+        }
+
         // Initialize new_pops to 0 so that we can accumulate the 
         // updated population sizes of each genotype
         for (size_t i = 0; i < new_pops.size(); i++) {
@@ -287,12 +619,186 @@ class NDimSim {
 
     }
 
+    // Same birth/death/mutation process as RunStep, but individuals of each
+    // genotype are split into blocks of at most STEP_BLOCK_SIZE, and blocks
+    // are handed out to STEP_THREADS threads. Each block gets its own random
+    // number generator, seeded from (step_seed, generation, genotype, block),
+    // and each thread accumulates offspring counts privately. Since counts
+    // are integers the final reduction is exact, so the outcome doesn't
+    // depend on how many threads were used or which thread got which block.
+    //
+    // With COMMON_RANDOM_NUMBERS, each block instead gets one stream per
+    // event class (death, birth, mutation), and every individual draws one
+    // number from each whether or not it needs it. The nth individual of a
+    // genotype then sees the same numbers in any run with the same seed,
+    // which keeps paired runs of different protocols closely correlated.
+    void RunStepParallel() {
+        // Birth rates don't change within a generation, so calculate them once
+        emp::vector<double> birth_rates(N_GENOTYPES);
+        for (int genotype = 0; genotype < N_GENOTYPES; genotype++) {
+            birth_rates[genotype] = Birth(genotype);
+            // Make sure the IndexMap is up-to-date before threads start
+            // reading from it (Index() will otherwise lazily rebuild it)
+            mut_rates[genotype].GetWeight();
+        }
+
+        struct Block {
+            int genotype;
+            uint64_t start; // Index of first individual in block
+            uint64_t count; // Number of individuals in block
+        };
+
+        emp::vector<Block> blocks;
+        for (int genotype = 0; genotype < N_GENOTYPES; genotype++) {
+            // Equivalent to the number of iterations of the serial loop
+            uint64_t n = (uint64_t) std::ceil(current_pops[genotype]);
+            for (uint64_t start = 0; start < n; start += STEP_BLOCK_SIZE) {
+                blocks.push_back({genotype, start, std::min<uint64_t>(STEP_BLOCK_SIZE, n - start)});
+            }
+        }
+
+        // Threads are started the first time they're needed and then kept
+        // for the rest of the run
+        if (STEP_THREADS > 1 && (!step_pool || step_pool->GetNumThreads() != (size_t) STEP_THREADS)) {
+            step_pool.reset(new StepPool(STEP_THREADS));
+        }
+
+        size_t n_threads = step_pool ? step_pool->GetNumThreads() : 1;
+        emp::vector<emp::vector<uint64_t>> counts(n_threads, emp::vector<uint64_t>(N_GENOTYPES, 0));
+        std::atomic<size_t> next_block(0);
+
+        auto worker = [&](size_t thread_id) {
+            // Offspring are counted per block and only added to this thread's
+            // totals at the end of it, so that threads aren't constantly
+            // writing to neighbouring memory
+            emp::vector<uint64_t> block_counts(N_GENOTYPES);
+            for (size_t b = next_block++; b < blocks.size(); b = next_block++) {
+                const Block & block = blocks[b];
+                std::fill(block_counts.begin(), block_counts.end(), 0);
+                uint64_t block_id = block.start / STEP_BLOCK_SIZE;
+                emp::IndexMap & mut_probs = mut_rates[block.genotype];
+                const double birth_rate = birth_rates[block.genotype];
+
+                if (COMMON_RANDOM_NUMBERS) {
+                    BlockRandom death_rnd(BlockSeed(step_seed, curr_gen, block.genotype, 3 * block_id));
+                    BlockRandom birth_rnd(BlockSeed(step_seed, curr_gen, block.genotype, 3 * block_id + 1));
+                    BlockRandom mut_rnd(BlockSeed(step_seed, curr_gen, block.genotype, 3 * block_id + 2));
+
+                    for (uint64_t individual = 0; individual < block.count; individual++) {
+                        double death_draw = death_rnd.GetDouble(1);
+                        double birth_draw = birth_rnd.GetDouble(1);
+                        double mut_draw = mut_rnd.GetDouble(1);
+
+                        if (death_draw - DEATH_RATE >= 0) {
+                            block_counts[block.genotype]++;
+                            if (birth_rate - birth_draw >= 0) {
+                                block_counts[mut_probs.Index(mut_draw)]++;
+                            }
+                        }
+                    }
+                } else {
+                    BlockRandom block_rnd(BlockSeed(step_seed, curr_gen, block.genotype, block_id));
+                    for (uint64_t individual = 0; individual < block.count; individual++) {
+                        // Check if individual died
+                        if (block_rnd.GetDouble(1) - DEATH_RATE >= 0) {
+                            block_counts[block.genotype]++; // Individual is still alive so we count it
+
+                            // Check if indiviudal gives birth
+                            if (birth_rate - block_rnd.GetDouble(1) >= 0) {
+                                // Select genotype of offsping based on transition probabilities
+                                block_counts[mut_probs.Index(block_rnd.GetDouble(1))]++;
+                            }
+                        }
+                    }
+                }
+
+                for (int genotype = 0; genotype < N_GENOTYPES; genotype++) {
+                    counts[thread_id][genotype] += block_counts[genotype];
+                }
+            }
+        };
+
+        // The calling thread does its share of the work too
+        if (step_pool) {
+            step_pool->Run(worker);
+        } else {
+            worker(0);
+        }
+
+        // Reduce per-thread counts into new population sizes
+        for (int genotype = 0; genotype < N_GENOTYPES; genotype++) {
+            new_pops[genotype] = 0;
+            for (size_t t = 0; t < n_threads; t++) {
+                new_pops[genotype] += counts[t][genotype];
+            }
+        }
+
+        // Update current population sizes
+        std::swap(current_pops, new_pops);
+    }
+
+    // Checks whether the population has stopped changing. Proportions are
+    // compared to those at the start of the current STEADY_STATE_WINDOW
+    // generation window, at the end of each window.
+    bool AtSteadyState() {
+        // The fitness change rule can be switched after set-up (e.g. by
+        // SetFitnessSchedule), so check it here rather than just once
+        if (STEADY_STATE_TOLERANCE <= 0 || !ConstantFitnesses() 
+            || curr_gen % STEADY_STATE_WINDOW != 0) {
+            return false;
+        }
+
+        long double total = emp::Sum(current_pops);
+        emp::vector<long double> props(N_GENOTYPES, 0);
+        if (total > 0) {
+            for (int i = 0; i < N_GENOTYPES; i++) {
+                props[i] = current_pops[i]/total;
+            }
+        }
+
+        bool steady = window_props.size() > 0;
+        for (int i = 0; i < N_GENOTYPES && steady; i++) {
+            if (std::abs(props[i] - window_props[i]) > STEADY_STATE_TOLERANCE) {
+                steady = false;
+            }
+        }
+        window_props = props;
+        return steady;
+    }
+
+    // Output data for current generation. Generations past GENERATIONS
+    // (e.g. from stepping a run manually) are left out of the trajectory.
+    void RecordGeneration(int gen) {
+        pop_sizes.Update(gen);
+        pop_props.Update(gen);
+        if (record_trajectory && gen >= 0 && gen <= GENERATIONS) {
+            std::copy(current_pops.begin(), current_pops.end(), 
+                      trajectory.begin() + gen * N_GENOTYPES);
+        }
+    }
+
     // Run for specified number of generations
     void Run() {
+        if (record_trajectory) {
+            trajectory.resize((GENERATIONS + 1) * N_GENOTYPES);
+        }
+        window_props.clear();
+        stop_gen = -1;
+
         for (int gen = 0; gen <= GENERATIONS; gen++) {
             curr_gen = gen;
-            pop_sizes.Update(gen);
-            pop_props.Update(gen);
+            RecordGeneration(gen);
+
+            if ((stop_condition && stop_condition(*this)) || AtSteadyState()) {
+                stop_gen = gen;
+                // Fast-forward to the end by repeating the current state
+                for (gen = gen + 1; gen <= GENERATIONS; gen++) {
+                    curr_gen = gen;
+                    RecordGeneration(gen);
+                }
+                break;
+            }
+
             RunStep();
         }
     }
@@ -313,7 +819,18 @@ class NDimSim {
         }
         // std::cout << emp::to_string(rel_fitnesses) << std::endl;
         for (int genotype = 0; genotype < N_GENOTYPES; genotype++) {
-            rel_fitnesses[genotype] = rel_fitnesses[15]/rel_fitnesses[genotype] - 1;
+            rel_fitnesses[genotype] = rel_fitnesses[N_GENOTYPES - 1]/rel_fitnesses[genotype] - 1;
+        }
+    }
+
+    // Switch to the environment scheduled for generation t. Fitnesses for
+    // every environment were calculated up front, so this is just a lookup
+    // (and nothing at all if the environment hasn't changed).
+    void sEnvironment(int t) {
+        int env = env_schedule[std::min(t, (int)env_schedule.size() - 1)];
+        if (env != current_env) {
+            rel_fitnesses = env_fitnesses[env];
+            current_env = env;
         }
     }
 
@@ -359,6 +876,80 @@ class NDimSim {
     }
 
     emp::vector<emp::IndexMap> GetMutRates() {return mut_rates;}
+    const emp::vector<long double> & GetCurrentPops() const {return current_pops;}
+    const emp::vector<long double> & GetRelFitnesses() const {return rel_fitnesses;}
+    emp::vector<long double> & GetTrajectory() {return trajectory;}
+    int GetGeneration() const {return curr_gen;}
+    int GetNumGenotypes() const {return N_GENOTYPES;}
+    int GetNumGenerations() const {return GENERATIONS;}
+    int GetFitnessChangeRule() const {return FITNESS_CHANGE_RULE;}
+    // Generation the last Run() stopped early at (-1 if it ran to the end)
+    int GetStopGeneration() const {return stop_gen;}
+
+    SimState GetState() const {
+        return {curr_gen, current_pops, rel_fitnesses, rnd, step_seed};
+    }
+
+    void SetState(const SimState & state) {
+        curr_gen = state.curr_gen;
+        current_pops = state.current_pops;
+        rel_fitnesses = state.rel_fitnesses;
+        rnd = state.rnd;
+        step_seed = state.step_seed;
+        current_env = -1; // rel_fitnesses may not match environment any more
+    }
+
+    // Give the simulation a new random number stream (seed must be positive)
+    void Reseed(int seed) {
+        rnd = emp::Random(seed);
+        if (BlockStep()) {
+            step_seed = ((uint64_t)rnd.GetUInt() << 32) | rnd.GetUInt();
+        }
+    }
+
+    // Go back to the initial population sizes at generation 0. The random
+    // number stream carries on, so the next run is a new replicate.
+    // The trajectory is cleared (without reallocating it) and starts with
+    // the initial population sizes, so that it's ready to be filled in
+    // one step at a time.
+    void Reset() {
+        curr_gen = 0;
+        current_pops = init_pops;
+        current_env = -1;
+        if (record_trajectory) {
+            trajectory.assign((GENERATIONS + 1) * N_GENOTYPES, 0);
+            std::copy(current_pops.begin(), current_pops.end(), trajectory.begin());
+        }
+    }
+
+    void SetGeneration(int gen) {curr_gen = gen;}
+    void SetRecordTrajectory(bool record) {record_trajectory = record;}
+
+    // Condition (checked every generation) under which Run() should stop
+    // early, in addition to STEADY_STATE_TOLERANCE. The remaining
+    // generations are filled in with the state the run stopped at.
+    void SetStopCondition(std::function<bool(const NDimSim &)> condition) {stop_condition = condition;}
+
+    // Overwrite current relative fitnesses. Only sticks between steps if
+    // the fitness change rule is NONE, since other rules recalculate them.
+    void SetRelFitnesses(const emp::vector<long double> & fitnesses) {rel_fitnesses = fitnesses;}
+
+    // Switch between the supplied environments (one row of relative fitnesses
+    // per environment) according to schedule (index of environment to use
+    // at each generation) in place of a fitness change rule
+    void SetEnvironments(const emp::vector<emp::vector<long double>> & fitnesses, const emp::vector<int> & schedule) {
+        env_fitnesses = fitnesses;
+        env_schedule = schedule;
+        current_env = -1;
+        FITNESS_CHANGE_RULE = (int)FITNESS_CHANGE_RULES::ENVIRONMENT_SCHEDULE;
+    }
+
+    // Use the supplied per-generation relative fitnesses (one row per
+    // generation) in place of a fitness change rule
+    void SetFitnessSchedule(const emp::vector<emp::vector<long double>> & schedule) {
+        cd_prescription_data = schedule;
+        FITNESS_CHANGE_RULE = (int)FITNESS_CHANGE_RULES::CD_PRESCRIPTION;
+    }
 
     emp::vector<long double> ExtractVectorFromConfig(std::string param, std::string name, std::string plural) {
         emp::vector<long double> result(N_GENOTYPES);
@@ -423,6 +1014,126 @@ class NDimSim {
         cs = ExtractVectorFromConfig(CS, "C", "Cs");
     }
 
+    // Convert growth rates to relative fitnesses (s), relative to the
+    // reference growth rate (which gets s = 0). Genotypes that can't grow
+    // get an effectively infinite s.
+    emp::vector<long double> GrowthRatesToS(const emp::vector<long double> & growth_rates, long double reference) {
+        emp::vector<long double> result(N_GENOTYPES);
+        for (int genotype = 0; genotype < N_GENOTYPES; genotype++) {
+            if (growth_rates[genotype] == 0) {
+                result[genotype] = 10000000000000;
+            } else {
+                result[genotype] = reference/growth_rates[genotype] - 1;
+            }
+            // Birth(genotype) divides by 1 + s
+            if (result[genotype] <= -1) {
+                std::cout << "Error: Growth rate " << growth_rates[genotype] << " of genotype " 
+                          << genotype << " gives a relative fitness of " << result[genotype]
+                          << ". Growth rates must not be negative." << std::endl;
+                exit(1);
+            }
+        }
+        return result;
+    }
+
+    // Calculate growth rates for an environment described by
+    // one entry of ENVIRONMENTS
+    emp::vector<long double> ParseEnvironment(std::string env) {
+        emp::vector<long double> landscape_growth(N_GENOTYPES, 0);
+        emp::vector<long double> drug_growth = drugless_fitnesses;
+        bool has_landscape = false;
+        bool has_drug = false;
+
+        for (std::string & term : emp::slice(env, '+')) {
+            if (term.find('@') != std::string::npos) {
+                // A drug at a fixed dose. Drugs act independently, so each 
+                // one scales the growth rate by its own hill function.
+                emp::vector<std::string> parts = emp::slice(term, '@');
+                emp::vector<long double> drug_IC50s = ExtractVectorFromConfig(parts[0], "IC50", "IC50s");
+                double dose = emp::from_string<double>(parts[1]);
+                if (dose > 0) {
+                    for (int genotype = 0; genotype < N_GENOTYPES; genotype++) {
+                        drug_growth[genotype] /= 1 + exp((drug_IC50s[genotype] - emp::Log10(dose))/cs[genotype]);
+                    }
+                }
+                has_drug = true;
+            } else {
+                // A (possibly weighted) fitness landscape
+                long double weight = 1;
+                if (term.find('*') != std::string::npos) {
+                    emp::vector<std::string> parts = emp::slice(term, '*');
+                    weight = emp::from_string<long double>(parts[0]);
+                    term = parts[1];
+                }
+                emp::vector<long double> growth = ExtractVectorFromConfig(term, "fitness", "fitnesses");
+                for (int genotype = 0; genotype < N_GENOTYPES; genotype++) {
+                    landscape_growth[genotype] += weight * growth[genotype];
+                }
+                has_landscape = true;
+            }
+        }
+
+        if (has_drug && has_landscape) {
+            std::cout << "Error: Environment " << env << " combines drugs with fitness landscapes. "
+                      << "Each environment must be made of one or the other." << std::endl;
+            exit(1);
+        }
+
+        return has_drug ? drug_growth : landscape_growth;
+    }
+
+    // Precompute relative fitnesses for every environment in ENVIRONMENTS, and
+    // work out which environment applies at each generation from
+    // ENVIRONMENT_SCHEDULE, giving errors as necessary.
+    void InitializeEnvironments() {
+        emp::vector<emp::vector<long double>> env_growth;
+        for (std::string & env : emp::slice(ENVIRONMENTS, ';')) {
+            env_growth.push_back(ParseEnvironment(env));
+        }
+
+        // Use the fastest growth rate in any environment as the reference,
+        // so that relative fitnesses are on the same scale in every
+        // environment and no genotype's birth rate exceeds Birth()
+        long double reference = 0;
+        for (emp::vector<long double> & growth : env_growth) {
+            reference = std::max(reference, emp::FindMax(growth));
+        }
+        if (reference <= 0) {
+            std::cout << "Error: No genotype can grow in any of the ENVIRONMENTS." << std::endl;
+            exit(1);
+        }
+
+        env_fitnesses.clear();
+        for (emp::vector<long double> & growth : env_growth) {
+            env_fitnesses.push_back(GrowthRatesToS(growth, reference));
+        }
+
+        // Expand schedule into one cycle's worth of environments
+        emp::vector<int> cycle;
+        for (std::string & entry : emp::slice(ENVIRONMENT_SCHEDULE, ',')) {
+            emp::vector<std::string> parts = emp::slice(entry, ':');
+            int env = emp::from_string<int>(parts[0]);
+            int duration = parts.size() > 1 ? emp::from_string<int>(parts[1]) : 0;
+            if (env < 0 || env >= (int)env_fitnesses.size() || duration <= 0) {
+                std::cout << "Error: Invalid ENVIRONMENT_SCHEDULE entry " << entry << 
+                    ". Entries should be environment:duration, with environment between 0 and " <<
+                    env_fitnesses.size() - 1 << " and a positive duration." << std::endl;
+                exit(1);
+            }
+            cycle.insert(cycle.end(), duration, env);
+        }
+
+        env_schedule.resize(GENERATIONS + 1);
+        for (int gen = 0; gen <= GENERATIONS; gen++) {
+            if (ENVIRONMENT_CYCLE) {
+                env_schedule[gen] = cycle[gen % cycle.size()];
+            } else {
+                env_schedule[gen] = cycle[std::min(gen, (int)cycle.size() - 1)];
+            }
+        }
+        current_env = -1;
+    }
+
     // Pull transition probabilities out of config parameter and put them in the
     // appropriate vector, giveing warnings and errors as neccessary.
     void InitializeTransitionProbs() {
@@ -0,0 +1,293 @@
+// Python bindings for NDimSim
+// Build with `make py`, which produces an extension module named n_dimensions
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include "n_dimensions.h"
+
+namespace py = pybind11;
+
+using ld_array = py::array_t<long double, py::array::c_style | py::array::forcecast>;
+
+// Copy a 1D array into a per-genotype vector, checking its length
+emp::vector<long double> ToGenotypeVector(ld_array arr, int n_genotypes, std::string name) {
+    if (arr.ndim() != 1 || arr.shape(0) != n_genotypes) {
+        throw py::value_error(name + " must be a 1D array with one value per genotype");
+    }
+    auto r = arr.unchecked<1>();
+    emp::vector<long double> result(n_genotypes);
+    for (int i = 0; i < n_genotypes; i++) {
+        result[i] = r(i);
+    }
+    return result;
+}
+
+// Copy a 2D array into a vector of rows, checking its number of columns
+emp::vector<emp::vector<long double>> ToRows(ld_array arr, int n_genotypes, std::string name) {
+    if (arr.ndim() != 2 || arr.shape(1) != n_genotypes) {
+        throw py::value_error(name + " must be a 2D array with one column per genotype");
+    }
+    auto r = arr.unchecked<2>();
+    emp::vector<emp::vector<long double>> result(r.shape(0), emp::vector<long double>(n_genotypes));
+    for (py::ssize_t i = 0; i < r.shape(0); i++) {
+        for (int j = 0; j < n_genotypes; j++) {
+            result[i][j] = r(i, j);
+        }
+    }
+    return result;
+}
+
+// Owns the (discarded) output streams along with the simulation, so that
+// each simulation can be run on its own thread without sharing a stream
+class PySim {
+    std::ostream sizes_os;
+    std::ostream props_os;
+    NDimSim sim;
+
+    public:
+    PySim(EvoConfig & config, const NDimSim::GenotypeValues & values)
+        : sizes_os(nullptr), props_os(nullptr), sim(config, values, sizes_os, props_os) {
+        sim.SetRecordTrajectory(true);
+        sim.Reset(); // Start the trajectory off at generation 0
+    }
+
+    NDimSim & GetSim() {return sim;}
+};
+
+PySim * MakeSim(ld_array fitnesses, ld_array init_pops,
+                py::array_t<double, py::array::c_style | py::array::forcecast> transition_probs,
+                int generations, double K, double death_rate, double max_birth_rate,
+                int random_seed, int fitness_change_rule, int genotype_to_drive,
+                int time_steps_before_ramp_up, double drug_dose,
+                py::object ic50s, py::object g_druglesses, py::object cs,
+                bool parallel_step, int step_threads, int step_block_size,
+                double steady_state_tolerance, int steady_state_window) {
+    int n_genotypes = (int) fitnesses.size();
+    if (n_genotypes < 2) {
+        throw py::value_error("Need at least 2 genotypes");
+    }
+
+    // NDimSim exits on some invalid settings, which would take the
+    // interpreter down with it, so catch them here first
+    if (generations < 0) {
+        throw py::value_error("generations must not be negative");
+    }
+    if (step_block_size <= 0) {
+        throw py::value_error("step_block_size must be positive");
+    }
+    if (steady_state_window <= 0) {
+        throw py::value_error("steady_state_window must be positive");
+    }
+    bool drive_rule = fitness_change_rule == (int)FITNESS_CHANGE_RULES::VAR ||
+                      fitness_change_rule == (int)FITNESS_CHANGE_RULES::VARCD;
+    if (drive_rule && (genotype_to_drive < 0 || genotype_to_drive >= n_genotypes)) {
+        throw py::value_error("genotype_to_drive must be between 0 and the number of genotypes - 1");
+    }
+
+    EvoConfig config;
+    config.RANDOM_SEED(random_seed);
+    config.GENERATIONS(generations);
+    config.N_GENOTYPES(n_genotypes);
+    config.K(K);
+    config.DEATH_RATE(death_rate);
+    config.MAX_BIRTH_RATE(max_birth_rate);
+    config.FITNESS_CHANGE_RULE(fitness_change_rule);
+    config.GENOTYPE_TO_DRIVE(genotype_to_drive);
+    config.TIME_STEPS_BEFORE_RAMP_UP(time_steps_before_ramp_up);
+    config.DRUG_DOSE(drug_dose);
+    config.PARALLEL_STEP(parallel_step);
+    config.STEP_THREADS(step_threads);
+    config.STEP_BLOCK_SIZE(step_block_size);
+    config.STEADY_STATE_TOLERANCE(steady_state_tolerance);
+    config.STEADY_STATE_WINDOW(steady_state_window);
+
+    NDimSim::GenotypeValues values;
+    values.fitnesses = ToGenotypeVector(fitnesses, n_genotypes, "fitnesses");
+    values.init_pops = ToGenotypeVector(init_pops, n_genotypes, "init_pops");
+
+    bool drug_rule = fitness_change_rule == (int)FITNESS_CHANGE_RULES::INCREASING_DRUG ||
+                     fitness_change_rule == (int)FITNESS_CHANGE_RULES::CONSTANT_DRUG;
+    if (drug_rule && (ic50s.is_none() || g_druglesses.is_none() || cs.is_none())) {
+        throw py::value_error("Fitness change rules 3 and 4 require ic50s, g_druglesses, and cs");
+    }
+    if (fitness_change_rule == (int)FITNESS_CHANGE_RULES::CD_PRESCRIPTION) {
+        throw py::value_error("Use set_fitness_schedule to supply a driving prescription");
+    }
+    if (fitness_change_rule == (int)FITNESS_CHANGE_RULES::ENVIRONMENT_SCHEDULE) {
+        throw py::value_error("Use set_environment_schedule to supply environments");
+    }
+    if (!ic50s.is_none()) values.ic50s = ToGenotypeVector(ic50s.cast<ld_array>(), n_genotypes, "ic50s");
+    if (!g_druglesses.is_none()) values.g_druglesses = ToGenotypeVector(g_druglesses.cast<ld_array>(), n_genotypes, "g_druglesses");
+    if (!cs.is_none()) values.cs = ToGenotypeVector(cs.cast<ld_array>(), n_genotypes, "cs");
+
+    if (transition_probs.ndim() != 2 || transition_probs.shape(0) != n_genotypes
+        || transition_probs.shape(1) != n_genotypes) {
+        throw py::value_error("transition_probs must be an N_GENOTYPES x N_GENOTYPES matrix");
+    }
+    auto t = transition_probs.unchecked<2>();
+    values.transition_probs.resize(n_genotypes, emp::vector<double>(n_genotypes));
+    for (int i = 0; i < n_genotypes; i++) {
+        double row_sum = 0;
+        for (int j = 0; j < n_genotypes; j++) {
+            values.transition_probs[i][j] = t(i, j);
+            row_sum += t(i, j);
+        }
+        // Weights within each row have to sum to 1 because that's how
+        // probability works
+        if (std::abs(row_sum - 1) > .00000001) {
+            throw py::value_error("Transition probabilities in row " + emp::to_string(i) + " must sum to 1");
+        }
+    }
+
+    return new PySim(config, values);
+}
+
+// Fitness schedules (rule 5) only have rows up to the last generation, so
+// make sure n more steps won't run past it
+void CheckSteps(NDimSim & sim, int n) {
+    if (sim.GetFitnessChangeRule() == (int)FITNESS_CHANGE_RULES::CD_PRESCRIPTION
+        && sim.GetGeneration() + n - 1 > sim.GetNumGenerations()) {
+        throw py::index_error("Fitness schedule only covers generations up to "
+                              + emp::to_string(sim.GetNumGenerations()) + "; call reset() to start over");
+    }
+}
+
+PYBIND11_MODULE(n_dimensions, m) {
+    m.doc() = "N-dimensional model of evolution under changing fitness landscapes";
+
+    py::class_<PySim>(m, "NDimSim")
+        .def(py::init(&MakeSim),
+             py::arg("fitnesses"), py::arg("init_pops"), py::arg("transition_probs"),
+             py::arg("generations") = 10, py::arg("K") = 10000,
+             py::arg("death_rate") = .05, py::arg("max_birth_rate") = 2,
+             py::arg("random_seed") = 0, py::arg("fitness_change_rule") = 0,
+             py::arg("genotype_to_drive") = 0, py::arg("time_steps_before_ramp_up") = 0,
+             py::arg("drug_dose") = .00015, py::arg("ic50s") = py::none(),
+             py::arg("g_druglesses") = py::none(), py::arg("cs") = py::none(),
+             py::arg("parallel_step") = false, py::arg("step_threads") = 0,
+             py::arg("step_block_size") = 262144, py::arg("steady_state_tolerance") = 0,
+             py::arg("steady_state_window") = 1000)
+
+        // Runs for the configured number of generations, starting from the
+        // initial population sizes at generation 0 (see reset()). The GIL is
+        // released so replicates can be run on separate Python threads.
+        .def("run", [](PySim & self) {
+                NDimSim & sim = self.GetSim();
+                sim.Reset();
+                sim.Run();
+             }, py::call_guard<py::gil_scoped_release>())
+
+        // Goes back to the initial population sizes at generation 0, e.g. to
+        // start a new replicate with run_step()/run_steps(). The random
+        // number stream is not reset, so the new replicate is independent.
+        .def("reset", [](PySim & self) {self.GetSim().Reset();})
+
+        // Advances a single generation, starting from the current one
+        .def("run_step", [](PySim & self) {
+                NDimSim & sim = self.GetSim();
+                CheckSteps(sim, 1);
+                sim.RunStep();
+                sim.SetGeneration(sim.GetGeneration() + 1);
+                sim.RecordGeneration(sim.GetGeneration());
+             }, py::call_guard<py::gil_scoped_release>())
+
+        // Advances n generations, one step at a time
+        .def("run_steps", [](PySim & self, int n) {
+                NDimSim & sim = self.GetSim();
+                CheckSteps(sim, n);
+                for (int i = 0; i < n; i++) {
+                    sim.RunStep();
+                    sim.SetGeneration(sim.GetGeneration() + 1);
+                    sim.RecordGeneration(sim.GetGeneration());
+                }
+             }, py::arg("n"), py::call_guard<py::gil_scoped_release>())
+
+        // Relative fitnesses to use at each generation (one row per generation,
+        // one column per genotype). Replaces the fitness change rule.
+        .def("set_fitness_schedule", [](PySim & self, ld_array schedule) {
+                NDimSim & sim = self.GetSim();
+                auto rows = ToRows(schedule, sim.GetNumGenotypes(), "schedule");
+                if ((int)rows.size() <= sim.GetNumGenerations()) {
+                    throw py::value_error("schedule needs a row for every generation (generations + 1 rows)");
+                }
+                sim.SetFitnessSchedule(rows);
+             }, py::arg("schedule"))
+
+        // Switches between environments (one row of relative fitnesses per
+        // environment) according to schedule (the index of the environment
+        // to use at each generation). Replaces the fitness change rule.
+        .def("set_environment_schedule", [](PySim & self, ld_array env_fitnesses,
+                                            py::array_t<int, py::array::c_style | py::array::forcecast> schedule) {
+                NDimSim & sim = self.GetSim();
+                auto rows = ToRows(env_fitnesses, sim.GetNumGenotypes(), "env_fitnesses");
+                if (schedule.ndim() != 1 || schedule.shape(0) <= sim.GetNumGenerations()) {
+                    throw py::value_error("schedule needs an environment for every generation (generations + 1 entries)");
+                }
+                auto r = schedule.unchecked<1>();
+                emp::vector<int> envs(r.shape(0));
+                for (py::ssize_t i = 0; i < r.shape(0); i++) {
+                    if (r(i) < 0 || r(i) >= (int)rows.size()) {
+                        throw py::value_error("schedule refers to an environment that doesn't exist");
+                    }
+                    envs[i] = r(i);
+                }
+                sim.SetEnvironments(rows, envs);
+             }, py::arg("env_fitnesses"), py::arg("schedule"))
+
+        // Calls condition(generation, current_pops) at every generation of
+        // run(), which stops early (repeating the current state for the
+        // remaining generations) once it returns True. run() releases the GIL,
+        // so it has to be taken back before calling into Python. Pass None to
+        // remove the condition.
+        .def("set_stop_condition", [](PySim & self, py::object condition) {
+                NDimSim & sim = self.GetSim();
+                if (condition.is_none()) {
+                    sim.SetStopCondition(nullptr);
+                    return;
+                }
+                sim.SetStopCondition([condition](const NDimSim & s) {
+                    py::gil_scoped_acquire gil;
+                    const emp::vector<long double> & pops = s.GetCurrentPops();
+                    return condition(s.GetGeneration(), ld_array((py::ssize_t) pops.size(), pops.data())).cast<bool>();
+                });
+             }, py::arg("condition"))
+
+        // Overwrites relative fitnesses before the next step (for use with
+        // fitness change rule 0 when driving the model one step at a time)
+        .def("set_fitnesses", [](PySim & self, ld_array fitnesses) {
+                NDimSim & sim = self.GetSim();
+                sim.SetRelFitnesses(ToGenotypeVector(fitnesses, sim.GetNumGenotypes(), "fitnesses"));
+             }, py::arg("fitnesses"))
+
+        // Population sizes at every generation since the last call to run() or
+        // reset(), as a (generations + 1) x N_GENOTYPES array. Generations that
+        // haven't been reached yet are 0, and steps past the last generation
+        // aren't recorded. This is a view onto the simulation's own memory (no
+        // copy is made), so it is overwritten by the next run() or reset() and
+        // keeps the simulation alive while in use.
+        .def_property_readonly("trajectory", [](py::object self_obj) {
+                PySim & self = self_obj.cast<PySim &>();
+                NDimSim & sim = self.GetSim();
+                emp::vector<long double> & traj = sim.GetTrajectory();
+                py::ssize_t n = sim.GetNumGenotypes();
+                py::ssize_t rows = (py::ssize_t) traj.size() / n;
+                return py::array_t<long double>({rows, n},
+                    {n * (py::ssize_t)sizeof(long double), (py::ssize_t)sizeof(long double)},
+                    traj.data(), self_obj);
+             })
+
+        .def_property_readonly("current_pops", [](PySim & self) {
+                const emp::vector<long double> & pops = self.GetSim().GetCurrentPops();
+                return ld_array((py::ssize_t) pops.size(), pops.data());
+             })
+        .def_property_readonly("rel_fitnesses", [](PySim & self) {
+                const emp::vector<long double> & fits = self.GetSim().GetRelFitnesses();
+                return ld_array((py::ssize_t) fits.size(), fits.data());
+             })
+        .def_property_readonly("generation", [](PySim & self) {return self.GetSim().GetGeneration();})
+        // Generation the last run() stopped early at (-1 if it ran to the end)
+        .def_property_readonly("stop_generation", [](PySim & self) {return self.GetSim().GetStopGeneration();})
+        .def_property_readonly("n_genotypes", [](PySim & self) {return self.GetSim().GetNumGenotypes();});
+}
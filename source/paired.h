@@ -0,0 +1,200 @@
+#include <memory>
+
+#include "replicate_stats.h"
+
+// Runs several protocols ("arms") side by side on common random numbers,
+// to compare them with far fewer replicates than independent ensembles.
+//
+// Every arm of a replicate uses the same seed with COMMON_RANDOM_NUMBERS,
+// so the nth individual of each genotype sees the same death, birth, and
+// mutation draws in every arm. Differences between arms then come mostly
+// from the protocols rather than from noise. For each arm after the first,
+// the per-generation difference in each genotype's proportion from the
+// first arm is reported, along with the variance of that difference and
+// the variance it would have had if the arms had been run independently.
+class PairedSim {
+    private:
+    struct Arm {
+        int rule;
+        std::string prescription;
+    };
+
+    emp::vector<Arm> arms;
+
+    // sims[t][a] is the simulation for arm a on thread t
+    emp::vector<std::unique_ptr<std::ostream>> null_streams;
+    emp::vector<emp::vector<std::unique_ptr<NDimSim>>> sims;
+    emp::vector<NDimSim::SimState> initial; // Per arm
+
+    emp::Random rnd; // For seeding replicates
+
+    // Each genotype's proportion at each generation (generation-major),
+    // and its difference from the first arm's
+    emp::vector<ReplicateStats> arm_props; // Per arm
+    emp::vector<ReplicateStats> diffs; // Per arm (first arm's is unused)
+    emp::vector<int> early_stops; // Per arm, number of replicates that stopped early
+
+    // Localized config parameters
+    int N_GENOTYPES;
+    int GENERATIONS;
+    int PAIRED_REPLICATES;
+    int ENSEMBLE_THREADS;
+
+    public:
+    PairedSim(EvoConfig & config) : rnd(config.RANDOM_SEED()) {
+        N_GENOTYPES = config.N_GENOTYPES();
+        GENERATIONS = config.GENERATIONS();
+        PAIRED_REPLICATES = config.PAIRED_REPLICATES();
+        ENSEMBLE_THREADS = std::min(EnsembleThreads(config), PAIRED_REPLICATES);
+
+        // Each arm is a fitness change rule, optionally followed by a colon
+        // and the driving prescription to use with it
+        for (std::string & arm : emp::slice(config.PAIRED_ARMS(), ',')) {
+            emp::vector<std::string> parts = emp::slice(arm, ':');
+            arms.push_back({emp::from_string<int>(parts[0]), parts.size() > 1 ? parts[1] : ""});
+        }
+        if (arms.size() < 2) {
+            std::cout << "Error: PAIRED_ARMS needs at least two arms." << std::endl;
+            exit(1);
+        }
+
+        // Random numbers need to line up individual-by-individual across arms
+        config.COMMON_RANDOM_NUMBERS(true);
+        // Replicates already run in parallel, and results don't depend on
+        // STEP_THREADS, so don't split individual steps across threads too
+        config.STEP_THREADS(1);
+
+        // Arms without their own prescription use the configured one
+        std::string default_prescription = config.CD_DRIVING_PRESCRIPTION();
+
+        sims.resize(ENSEMBLE_THREADS);
+        for (int t = 0; t < ENSEMBLE_THREADS; t++) {
+            null_streams.emplace_back(new std::ostream(nullptr));
+            for (Arm & arm : arms) {
+                config.FITNESS_CHANGE_RULE(arm.rule);
+                config.CD_DRIVING_PRESCRIPTION(arm.prescription != "" ? arm.prescription : default_prescription);
+                sims[t].emplace_back(new NDimSim(config, *null_streams.back(), *null_streams.back()));
+                sims[t].back()->SetRecordTrajectory(true);
+            }
+        }
+        for (auto & sim : sims[0]) {
+            initial.push_back(sim->GetState());
+        }
+
+        size_t n_values = (GENERATIONS + 1) * N_GENOTYPES;
+        arm_props.resize(arms.size());
+        diffs.resize(arms.size());
+        early_stops.resize(arms.size(), 0);
+        for (size_t a = 0; a < arms.size(); a++) {
+            arm_props[a].Resize(n_values);
+            diffs[a].Resize(n_values);
+        }
+    }
+
+    // Add one replicate (all arms) to the running statistics
+    void Accumulate(emp::vector<std::unique_ptr<NDimSim>> & replicate) {
+        emp::vector<double> base = TrajectoryProportions(replicate[0]->GetTrajectory(), N_GENOTYPES);
+        arm_props[0].Add(base);
+        for (size_t a = 0; a < arms.size(); a++) {
+            if (replicate[a]->GetStopGeneration() >= 0) {
+                early_stops[a]++;
+            }
+        }
+        for (size_t a = 1; a < arms.size(); a++) {
+            emp::vector<double> props = TrajectoryProportions(replicate[a]->GetTrajectory(), N_GENOTYPES);
+            arm_props[a].Add(props);
+            for (size_t idx = 0; idx < props.size(); idx++) {
+                props[idx] -= base[idx];
+            }
+            diffs[a].Add(props);
+        }
+    }
+
+    void Run() {
+        while (arm_props[0].count < PAIRED_REPLICATES) {
+            int batch = std::min(ENSEMBLE_THREADS, PAIRED_REPLICATES - arm_props[0].count);
+
+            // Seeds are drawn in replicate order, before threads start.
+            // All arms of a replicate share a seed.
+            emp::vector<int> seeds(batch);
+            for (int t = 0; t < batch; t++) {
+                seeds[t] = ReplicateSeed(rnd);
+            }
+
+            emp::vector<std::thread> threads;
+            for (int t = 0; t < batch; t++) {
+                threads.emplace_back([this, t, &seeds](){
+                    for (size_t a = 0; a < arms.size(); a++) {
+                        sims[t][a]->SetState(initial[a]);
+                        sims[t][a]->Reseed(seeds[t]);
+                        sims[t][a]->Run();
+                    }
+                });
+            }
+            for (std::thread & thread : threads) {
+                thread.join();
+            }
+
+            for (int t = 0; t < batch; t++) {
+                Accumulate(sims[t]);
+            }
+        }
+
+        PrintResults();
+    }
+
+    // Writes paired_diffs.csv, with a row for each generation and arm after
+    // the first. For each genotype, it has the mean difference in proportion
+    // from the first arm (diff), the variance of that difference across
+    // replicates (diff_var), and the variance the difference would have if
+    // the arms were run independently (unpaired_var).
+    void PrintResults() {
+        emp::DataFile diff_file("paired_diffs.csv");
+        int gen = 0;
+        size_t arm = 1;
+
+        diff_file.AddVar(gen, "generation");
+        diff_file.AddVar(arm, "arm");
+        for (int i = 0; i < N_GENOTYPES; i++) {
+            std::string suffix = emp::to_string(i);
+            diff_file.AddFun((std::function<double()>)[i, &gen, &arm, this](){
+                return diffs[arm].means[gen * N_GENOTYPES + i];
+            }, "diff" + suffix);
+            diff_file.AddFun((std::function<double()>)[i, &gen, &arm, this](){
+                return diffs[arm].Variance(gen * N_GENOTYPES + i);
+            }, "diff" + suffix + "_var");
+            diff_file.AddFun((std::function<double()>)[i, &gen, &arm, this](){
+                size_t idx = gen * N_GENOTYPES + i;
+                return arm_props[0].Variance(idx) + arm_props[arm].Variance(idx);
+            }, "unpaired" + suffix + "_var");
+        }
+        diff_file.PrintHeaderKeys();
+
+        // Also total up variances to summarize how much pairing helped
+        emp::vector<double> paired_total(arms.size(), 0);
+        emp::vector<double> unpaired_total(arms.size(), 0);
+        for (gen = 0; gen <= GENERATIONS; gen++) {
+            for (arm = 1; arm < arms.size(); arm++) {
+                diff_file.Update();
+                for (int i = 0; i < N_GENOTYPES; i++) {
+                    size_t idx = gen * N_GENOTYPES + i;
+                    paired_total[arm] += diffs[arm].Variance(idx);
+                    unpaired_total[arm] += arm_props[0].Variance(idx) + arm_props[arm].Variance(idx);
+                }
+            }
+        }
+
+        for (arm = 0; arm < arms.size(); arm++) {
+            if (early_stops[arm] > 0) {
+                std::cout << "Arm " << arm << ": " << early_stops[arm] << " of "
+                          << arm_props[arm].count << " replicates stopped early" << std::endl;
+            }
+        }
+        for (arm = 1; arm < arms.size(); arm++) {
+            std::cout << "Arm " << arm << " vs. arm 0: variance of differences is "
+                      << paired_total[arm] / unpaired_total[arm]
+                      << " times what independent runs would give" << std::endl;
+        }
+    }
+
+};
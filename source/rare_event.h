@@ -0,0 +1,259 @@
+#include <algorithm>
+
+#include "replicate_stats.h"
+
+// Weighted ensemble estimate of the distribution of first-passage times
+// for a target genotype reaching a threshold proportion of the population.
+//
+// Replicates ("walkers") each carry a statistical weight. They are binned
+// by the target genotype's current proportion (using SPLITTING_LEVELS as
+// bin boundaries). Every RESAMPLE_INTERVAL generations, walkers in crowded
+// bins are merged and walkers in sparse bins are split, so every occupied
+// bin has WALKERS_PER_BIN walkers. Merging and splitting conserve total
+// weight and don't change the expected weight in any part of the state
+// space (Huber and Kim 1996), so the weight of walkers that reach the
+// threshold at each generation is an unbiased estimate of the probability
+// of first passage at that generation, while many more walkers are spent
+// on the rare trajectories that make progress towards the threshold.
+//
+// SPLITTING_REPEATS independent ensembles are run, and the spread between
+// them gives confidence intervals.
+class SplittingSim {
+    private:
+    // Simulation used to propagate walkers. Each walker's state is
+    // loaded into it, advanced, and saved back out.
+    std::ostream sizes_os;
+    std::ostream props_os;
+    NDimSim sim;
+
+    emp::Random rnd; // For splitting/merging decisions and seeding walkers
+
+    struct Walker {
+        NDimSim::SimState state;
+        double weight;
+    };
+
+    // Localized config parameters
+    int GENERATIONS;
+    int TARGET_GENOTYPE;
+    double TARGET_THRESHOLD;
+    int WALKERS_PER_BIN;
+    int RESAMPLE_INTERVAL;
+    int SPLITTING_REPEATS;
+    emp::vector<double> levels;
+
+    // first_passage[r][t] is the weight that first reached the threshold
+    // at generation t in repeat r
+    emp::vector<emp::vector<double>> first_passage;
+
+    public:
+    SplittingSim(EvoConfig & config)
+        : sizes_os(nullptr), props_os(nullptr), sim(config, sizes_os, props_os),
+          rnd(config.RANDOM_SEED()) {
+        GENERATIONS = config.GENERATIONS();
+        TARGET_GENOTYPE = config.TARGET_GENOTYPE();
+        TARGET_THRESHOLD = config.TARGET_THRESHOLD();
+        WALKERS_PER_BIN = config.WALKERS_PER_BIN();
+        RESAMPLE_INTERVAL = config.RESAMPLE_INTERVAL();
+        SPLITTING_REPEATS = config.SPLITTING_REPEATS();
+
+        if (TARGET_GENOTYPE < 0 || TARGET_GENOTYPE >= config.N_GENOTYPES()) {
+            std::cout << "Error: TARGET_GENOTYPE must be between 0 and N_GENOTYPES - 1." << std::endl;
+            exit(1);
+        }
+        if (WALKERS_PER_BIN < 1 || RESAMPLE_INTERVAL < 1 || SPLITTING_REPEATS < 1) {
+            std::cout << "Error: WALKERS_PER_BIN, RESAMPLE_INTERVAL, and SPLITTING_REPEATS must be positive." << std::endl;
+            exit(1);
+        }
+
+        for (std::string & level : emp::slice(config.SPLITTING_LEVELS(), ',')) {
+            levels.push_back(emp::from_string<double>(level));
+        }
+        for (size_t i = 0; i < levels.size(); i++) {
+            if ((i > 0 && levels[i] <= levels[i-1]) || levels[i] >= TARGET_THRESHOLD) {
+                std::cout << "Error: SPLITTING_LEVELS must be increasing and below TARGET_THRESHOLD." << std::endl;
+                exit(1);
+            }
+        }
+    }
+
+    // Proportion of the population that has the target genotype
+    double TargetProportion(const NDimSim::SimState & state) {
+        long double total = emp::Sum(state.current_pops);
+        if (total <= 0) {
+            return 0;
+        }
+        return (double)(state.current_pops[TARGET_GENOTYPE] / total);
+    }
+
+    // Index of the bin that a given proportion falls in
+    size_t Bin(double proportion) {
+        return std::upper_bound(levels.begin(), levels.end(), proportion) - levels.begin();
+    }
+
+    // Split and merge walkers so that each occupied bin holds WALKERS_PER_BIN
+    void Resample(emp::vector<Walker> & walkers) {
+        emp::vector<emp::vector<Walker>> bins(levels.size() + 1);
+        for (Walker & w : walkers) {
+            bins[Bin(TargetProportion(w.state))].push_back(std::move(w));
+        }
+
+        walkers.clear();
+        for (emp::vector<Walker> & bin : bins) {
+            if (bin.empty()) {
+                continue;
+            }
+
+            // Merge the two lightest walkers, keeping one of them with
+            // probability proportional to its weight
+            while ((int)bin.size() > WALKERS_PER_BIN) {
+                std::sort(bin.begin(), bin.end(),
+                          [](const Walker & a, const Walker & b){return a.weight < b.weight;});
+                double combined = bin[0].weight + bin[1].weight;
+                if (rnd.GetDouble(combined) < bin[1].weight) {
+                    std::swap(bin[0], bin[1]);
+                }
+                bin[0].weight = combined;
+                bin.erase(bin.begin() + 1);
+            }
+
+            // Split the heaviest walker into two with half the weight each.
+            // The copy gets a new random number stream so they diverge.
+            while ((int)bin.size() < WALKERS_PER_BIN) {
+                auto heaviest = std::max_element(bin.begin(), bin.end(),
+                          [](const Walker & a, const Walker & b){return a.weight < b.weight;});
+                heaviest->weight /= 2;
+                Walker clone = *heaviest;
+                sim.SetState(clone.state);
+                sim.Reseed(ReplicateSeed(rnd));
+                clone.state = sim.GetState();
+                bin.push_back(std::move(clone));
+            }
+
+            for (Walker & w : bin) {
+                walkers.push_back(std::move(w));
+            }
+        }
+    }
+
+    // Run one weighted ensemble, returning weight of first passage at each generation
+    emp::vector<double> RunEnsemble(const NDimSim::SimState & initial) {
+        emp::vector<double> passage(GENERATIONS + 1, 0);
+
+        // All walkers start from the same initial state, with their own
+        // random number streams
+        emp::vector<Walker> walkers;
+        for (int i = 0; i < WALKERS_PER_BIN; i++) {
+            sim.SetState(initial);
+            sim.Reseed(ReplicateSeed(rnd));
+            walkers.push_back({sim.GetState(), 1.0 / WALKERS_PER_BIN});
+        }
+
+        if (TargetProportion(initial) >= TARGET_THRESHOLD) {
+            passage[0] = 1;
+            return passage;
+        }
+
+        for (int gen = 0; gen < GENERATIONS && walkers.size(); gen += RESAMPLE_INTERVAL) {
+            int end_gen = std::min(gen + RESAMPLE_INTERVAL, GENERATIONS);
+            emp::vector<Walker> survivors;
+
+            // Advance each walker to the next resampling point, removing
+            // any that reach the threshold along the way
+            for (Walker & w : walkers) {
+                sim.SetState(w.state);
+                bool passed = false;
+                for (int t = gen; t < end_gen; t++) {
+                    sim.SetGeneration(t);
+                    sim.RunStep();
+                    double prop = (double)(sim.GetCurrentPops()[TARGET_GENOTYPE] / emp::Sum(sim.GetCurrentPops()));
+                    if (prop >= TARGET_THRESHOLD) {
+                        passage[t + 1] += w.weight;
+                        passed = true;
+                        break;
+                    }
+                }
+                if (!passed) {
+                    sim.SetGeneration(end_gen);
+                    w.state = sim.GetState();
+                    survivors.push_back(std::move(w));
+                }
+            }
+
+            walkers = std::move(survivors);
+            Resample(walkers);
+        }
+
+        return passage;
+    }
+
+    void Run() {
+        NDimSim::SimState initial = sim.GetState();
+        first_passage.clear();
+        for (int r = 0; r < SPLITTING_REPEATS; r++) {
+            first_passage.push_back(RunEnsemble(initial));
+            std::cout << "Repeat " << r << ": P(first passage by generation "
+                      << GENERATIONS << ") = " << emp::Sum(first_passage.back()) << std::endl;
+        }
+        PrintResults();
+    }
+
+    // Writes first_passage.csv, containing the estimated probability of first
+    // passage at each generation and the cumulative probability of having
+    // reached the threshold by each generation (with confidence intervals)
+    void PrintResults() {
+        // Statistics across repeats of the probability of first passage at,
+        // and by, each generation
+        ReplicateStats prob;
+        ReplicateStats cum;
+        prob.Resize(GENERATIONS + 1);
+        cum.Resize(GENERATIONS + 1);
+        for (int r = 0; r < SPLITTING_REPEATS; r++) {
+            emp::vector<double> cumulative(GENERATIONS + 1);
+            double total = 0;
+            for (int t = 0; t <= GENERATIONS; t++) {
+                total += first_passage[r][t];
+                cumulative[t] = total;
+            }
+            prob.Add(first_passage[r]);
+            cum.Add(cumulative);
+        }
+
+        emp::DataFile fpt_file("first_passage.csv");
+        int gen = 0;
+
+        fpt_file.AddVar(gen, "generation");
+        fpt_file.AddFun((std::function<double()>)[&prob, &gen](){return prob.means[gen];}, "prob");
+        fpt_file.AddFun((std::function<double()>)[&prob, &gen](){return prob.CIHalfWidth(gen);}, "prob_ci");
+        fpt_file.AddFun((std::function<double()>)[&cum, &gen](){return cum.means[gen];}, "cumulative");
+        fpt_file.AddFun((std::function<double()>)[&cum, &gen](){return std::max(0.0, cum.means[gen] - cum.CIHalfWidth(gen));}, "cumulative_lower");
+        fpt_file.AddFun((std::function<double()>)[&cum, &gen](){return std::min(1.0, cum.means[gen] + cum.CIHalfWidth(gen));}, "cumulative_upper");
+        fpt_file.PrintHeaderKeys();
+
+        for (gen = 0; gen <= GENERATIONS; gen++) {
+            fpt_file.Update();
+        }
+
+        // Mean first-passage time, given that the threshold is reached
+        ReplicateStats mean_time;
+        mean_time.Resize(1);
+        for (int r = 0; r < SPLITTING_REPEATS; r++) {
+            double total = emp::Sum(first_passage[r]);
+            if (total > 0) {
+                double weighted = 0;
+                for (int t = 0; t <= GENERATIONS; t++) {
+                    weighted += t * first_passage[r][t];
+                }
+                mean_time.Add({weighted / total});
+            }
+        }
+
+        std::cout << "P(first passage by generation " << GENERATIONS << "): "
+                  << cum.means[GENERATIONS] << " +/- " << cum.CIHalfWidth(GENERATIONS) << std::endl;
+        if (mean_time.count) {
+            std::cout << "Mean first-passage time (when reached): "
+                      << mean_time.means[0] << " +/- " << mean_time.CIHalfWidth(0) << std::endl;
+        }
+    }
+
+};
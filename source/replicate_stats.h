@@ -0,0 +1,117 @@
+#include <cmath>
+#include <thread>
+
+#include "n_dimensions.h"
+
+// Helpers shared by the drivers that run many replicates of NDimSim
+
+// Positive seed for a new replicate's random number stream, drawn from
+// the driver's own generator (emp::Random treats seeds <= 0 as a request
+// to seed from the clock)
+int ReplicateSeed(emp::Random & rnd) {
+    return (int)(rnd.GetUInt() >> 1) | 1;
+}
+
+// Number of replicates to run at once (ENSEMBLE_THREADS, or the number
+// of available cores if that is 0)
+int EnsembleThreads(EvoConfig & config) {
+    int threads = config.ENSEMBLE_THREADS();
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return threads;
+}
+
+// Proportion of the population with each genotype at each generation of a
+// trajectory of population sizes (both generation-major)
+emp::vector<double> TrajectoryProportions(const emp::vector<long double> & trajectory, int n_genotypes) {
+    emp::vector<double> props(trajectory.size());
+    for (size_t row = 0; row < trajectory.size(); row += n_genotypes) {
+        long double total = 0;
+        for (int i = 0; i < n_genotypes; i++) {
+            total += trajectory[row + i];
+        }
+        for (int i = 0; i < n_genotypes; i++) {
+            props[row + i] = total > 0 ? (double)(trajectory[row + i]/total) : 0;
+        }
+    }
+    return props;
+}
+
+// Running mean and sum of squared deviations of a set of values across
+// replicates (e.g. each genotype's proportion at each generation)
+struct ReplicateStats {
+    emp::vector<double> means;
+    emp::vector<double> sq_devs;
+    int count = 0;
+
+    void Resize(size_t n) {
+        means.resize(n, 0);
+        sq_devs.resize(n, 0);
+    }
+
+    // Add one replicate's values (Welford's algorithm)
+    void Add(const emp::vector<double> & values) {
+        count++;
+        for (size_t idx = 0; idx < means.size(); idx++) {
+            double delta = values[idx] - means[idx];
+            means[idx] += delta / count;
+            sq_devs[idx] += delta * (values[idx] - means[idx]);
+        }
+    }
+
+    // Combine statistics from another group of replicates into these
+    // (Chan et al.'s parallel variance algorithm)
+    void Merge(const ReplicateStats & other) {
+        double n_a = count;
+        double n_b = other.count;
+        double n = n_a + n_b;
+        for (size_t idx = 0; idx < means.size(); idx++) {
+            double delta = other.means[idx] - means[idx];
+            means[idx] += delta * n_b / n;
+            sq_devs[idx] += other.sq_devs[idx] + delta * delta * n_a * n_b / n;
+        }
+        count += other.count;
+    }
+
+    double Variance(size_t idx) const {
+        return count > 1 ? sq_devs[idx] / (count - 1) : 0;
+    }
+
+    // 95% confidence interval half-width of mean
+    double CIHalfWidth(size_t idx) const {
+        if (count < 2) {
+            return INFINITY;
+        }
+        return 1.96 * std::sqrt(sq_devs[idx] / (count - 1) / count);
+    }
+
+    // Widest confidence interval across all values
+    double MaxCIHalfWidth() const {
+        double max_width = 0;
+        for (size_t idx = 0; idx < means.size(); idx++) {
+            max_width = std::max(max_width, CIHalfWidth(idx));
+        }
+        return max_width;
+    }
+};
+
+// Writes the mean proportion of each genotype at each generation, and its
+// 95% confidence interval half-width, to filename
+void PrintProportions(const ReplicateStats & stats, std::string filename, int n_genotypes, int generations) {
+    emp::DataFile props_file(filename);
+    int gen = 0;
+    int replicates = stats.count;
+
+    props_file.AddVar(gen, "generation");
+    props_file.AddVar(replicates, "replicates");
+    for (int i = 0; i < n_genotypes; i++) {
+        props_file.AddFun((std::function<double()>)[i, &gen, &stats, n_genotypes](){return stats.means[gen * n_genotypes + i];}, "prop" + emp::to_string(i));
+        props_file.AddFun((std::function<double()>)[i, &gen, &stats, n_genotypes](){return stats.CIHalfWidth(gen * n_genotypes + i);}, "prop" + emp::to_string(i) + "_ci");
+    }
+    props_file.PrintHeaderKeys();
+
+    for (gen = 0; gen <= generations; gen++) {
+        props_file.Update();
+    }
+}